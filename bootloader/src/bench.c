@@ -0,0 +1,283 @@
+// Crypto micro-benchmarks for the BearSSL primitives the bootloader can use.
+// Built with "make bench" and run under QEMU with "make bench-run", see the
+// README. Each result is printed on UART2 as one line of JSON.
+
+// Hardware Imports
+#include "inc/hw_memmap.h" // Peripheral Base Addresses
+#include "inc/hw_types.h"  // Boolean type
+
+// Driver API Imports
+#include "driverlib/sysctl.h"  // System control API (clock/reset)
+#include "driverlib/systick.h" // SysTick API
+
+// Library Imports
+#include <string.h>
+
+// Application Imports
+#include "beaverssl.h"
+#include "bench_sizes.h"
+#include "utility.h"
+
+// Bytes processed per AES run, and how many runs are averaged
+#define AES_BENCH_SIZE 1024
+#define AES_BENCH_RUNS 8
+
+// SHA-256 is timed over each of these input sizes
+#define SHA_BENCH_MAX 16384
+static const uint32_t sha_bench_sizes[] = {64, 1024, SHA_BENCH_MAX};
+
+// Fixed P-256 test vector: a public key, a SHA-256 digest and a raw (r || s)
+// signature of it
+static const unsigned char bench_q[] = {
+    0x04, 0xac, 0x18, 0xc2, 0xbe, 0xd1, 0x52, 0x97,
+    0x6c, 0x77, 0xce, 0xd4, 0x00, 0x7e, 0x5f, 0x44,
+    0xaf, 0xf3, 0x3b, 0x38, 0xf5, 0x63, 0x16, 0x3b,
+    0xfe, 0xc4, 0x59, 0x82, 0x5a, 0xa6, 0xa2, 0xa7,
+    0x39, 0xca, 0x7f, 0x4d, 0xef, 0xba, 0xe2, 0x9f,
+    0xc7, 0xca, 0x3c, 0xde, 0x8c, 0x12, 0x48, 0xd8,
+    0x49, 0x59, 0x4d, 0xbd, 0xa6, 0x26, 0x50, 0x06,
+    0x84, 0x76, 0xf9, 0xd7, 0x11, 0xa8, 0x84, 0xfa,
+    0xc8,
+};
+static const unsigned char bench_hash[] = {
+    0x3c, 0xb2, 0xbf, 0x13, 0xc0, 0x7b, 0x2a, 0x27,
+    0x7e, 0x02, 0x80, 0xa5, 0x68, 0x59, 0x9b, 0x4b,
+    0x0f, 0xf0, 0xc4, 0xb1, 0x10, 0x67, 0xdb, 0xd4,
+    0x54, 0xfd, 0x76, 0x32, 0xde, 0x78, 0x4c, 0xba,
+};
+static const unsigned char bench_sig[] = {
+    0x60, 0xa8, 0xdf, 0x82, 0xfe, 0x39, 0xbe, 0x32,
+    0xc1, 0x2f, 0x41, 0x56, 0x33, 0xf1, 0x4f, 0xe5,
+    0x13, 0x4a, 0xa2, 0x5e, 0xb3, 0x10, 0xe6, 0xf8,
+    0xa2, 0x9c, 0x90, 0x71, 0x63, 0x9c, 0x96, 0x4e,
+    0xb7, 0x3f, 0x8b, 0x82, 0xf5, 0xda, 0x66, 0xe7,
+    0xaa, 0xee, 0x90, 0x3b, 0xd8, 0x9c, 0x47, 0x94,
+    0xa6, 0x74, 0x02, 0x4c, 0x04, 0xdd, 0xea, 0xff,
+    0xb2, 0xc5, 0x25, 0xf3, 0x8d, 0xa9, 0x65, 0x54,
+};
+
+// An object of libbearssl.a belongs to a variant when its name starts with
+// one of the variant's prefixes
+typedef struct _bench_object_size {
+    const char* name;
+    uint32_t size;
+} bench_object_size;
+
+static const bench_object_size object_sizes[] = {BENCH_OBJECT_SIZES};
+
+typedef struct _cbcdec_bench {
+    const char* name;
+    const br_block_cbcdec_class* vtable;
+    const char* prefixes[5];
+} cbcdec_bench;
+
+typedef struct _ctr_bench {
+    const char* name;
+    const br_block_ctr_class* vtable;
+    const char* prefixes[5];
+} ctr_bench;
+
+typedef struct _ecdsa_bench {
+    const char* name;
+    br_ecdsa_vrfy vrfy;
+    const br_ec_impl* impl;
+    const char* prefixes[5];
+} ecdsa_bench;
+
+static const cbcdec_bench cbcdec_benches[] = {
+    {"aes_big_cbcdec", &br_aes_big_cbcdec_vtable,
+     {"aes_big_cbcdec", "aes_big_dec", "aes_common", NULL}},
+    {"aes_small_cbcdec", &br_aes_small_cbcdec_vtable,
+     {"aes_small_cbcdec", "aes_small_dec", "aes_common", NULL}},
+    {"aes_ct_cbcdec", &br_aes_ct_cbcdec_vtable,
+     {"aes_ct_cbcdec", "aes_ct_dec", "aes_ct.o", "aes_common", NULL}},
+};
+
+static const ctr_bench ctr_benches[] = {
+    {"aes_big_ctr", &br_aes_big_ctr_vtable,
+     {"aes_big_ctr", "aes_big_enc", "aes_common", NULL}},
+    {"aes_small_ctr", &br_aes_small_ctr_vtable,
+     {"aes_small_ctr", "aes_small_enc", "aes_common", NULL}},
+    {"aes_ct_ctr", &br_aes_ct_ctr_vtable,
+     {"aes_ct_ctr", "aes_ct_enc", "aes_ct.o", "aes_common", NULL}},
+};
+
+// The i31/i15 prefixes take in every big-integer helper of that size, so
+// these are upper bounds
+static const ecdsa_bench ecdsa_benches[] = {
+    {"ecdsa_i31_m31", br_ecdsa_i31_vrfy_raw, &br_ec_p256_m31,
+     {"ecdsa_i31_", "ec_p256_m31", "i31_", NULL}},
+    {"ecdsa_i31_m15", br_ecdsa_i31_vrfy_raw, &br_ec_p256_m15,
+     {"ecdsa_i31_", "ec_p256_m15", "i31_", NULL}},
+    {"ecdsa_i15_m15", br_ecdsa_i15_vrfy_raw, &br_ec_p256_m15,
+     {"ecdsa_i15_", "ec_p256_m15", "i15_", NULL}},
+    {"ecdsa_i15_m31", br_ecdsa_i15_vrfy_raw, &br_ec_p256_m31,
+     {"ecdsa_i15_", "ec_p256_m31", "i15_", NULL}},
+};
+
+static const char* sha_prefixes[] = {"sha2small", NULL};
+
+// Cycles per SysTick period, SysTick fires once per millisecond
+static uint32_t systick_period;
+
+// Bench input, also used as the AES key
+static unsigned char buffer[SHA_BENCH_MAX];
+
+// Cycles since systick_init, wraps every 2^32 cycles
+static uint32_t bench_cycles(void) {
+    uint32_t ms;
+    uint32_t value;
+
+    // Retry if a tick lands between the two reads
+    do {
+        ms = systick_ms();
+        value = SysTickValueGet();
+    } while (ms != systick_ms());
+
+    return ms * systick_period + (systick_period - 1 - value);
+}
+
+// Sum of the sizes of the library objects matching any of the prefixes.
+// A name ending in ".o" has to match exactly.
+static uint32_t code_size(const char* const* prefixes) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < sizeof(object_sizes) / sizeof(object_sizes[0]);
+         i++) {
+        for (const char* const* prefix = prefixes; *prefix; prefix++) {
+            size_t len = strlen(*prefix);
+            int exact = len > 2 && strcmp(*prefix + len - 2, ".o") == 0;
+            if (exact ? strncmp(object_sizes[i].name, *prefix, len - 2) == 0 &&
+                            object_sizes[i].name[len - 2] == '\0'
+                      : strncmp(object_sizes[i].name, *prefix, len) == 0) {
+                total += object_sizes[i].size;
+                break;
+            }
+        }
+    }
+    return total;
+}
+
+static void write_number(uint32_t value) {
+    // itoa takes an int, every value printed here fits
+    char digits[11];
+    itoa((int)value, digits, 10);
+    uart_write_str(UART2, digits);
+}
+
+// {"bench":"<name>","bytes":<bytes>,"cycles":<cycles>,"code":<code>}
+static void report(const char* name, uint32_t bytes, uint32_t cycles,
+                   uint32_t code) {
+    uart_write_str(UART2, "{\"bench\":\"");
+    uart_write_str(UART2, (char*)name);
+    uart_write_str(UART2, "\",\"bytes\":");
+    write_number(bytes);
+    uart_write_str(UART2, ",\"cycles\":");
+    write_number(cycles);
+    uart_write_str(UART2, ",\"code\":");
+    write_number(code);
+    uart_write_str(UART2, "}\n");
+}
+
+static void bench_cbcdec(const cbcdec_bench* bench) {
+    br_aes_gen_cbcdec_keys keys;
+    unsigned char iv[16] = {0};
+
+    bench->vtable->init(&keys.vtable, buffer, 32);
+
+    uint32_t start = bench_cycles();
+    for (int run = 0; run < AES_BENCH_RUNS; run++) {
+        bench->vtable->run(&keys.vtable, iv, buffer, AES_BENCH_SIZE);
+    }
+    uint32_t cycles = (bench_cycles() - start) / AES_BENCH_RUNS;
+
+    report(bench->name, AES_BENCH_SIZE, cycles, code_size(bench->prefixes));
+}
+
+static void bench_ctr(const ctr_bench* bench) {
+    br_aes_gen_ctr_keys keys;
+    unsigned char iv[12] = {0};
+
+    bench->vtable->init(&keys.vtable, buffer, 32);
+
+    uint32_t start = bench_cycles();
+    for (int run = 0; run < AES_BENCH_RUNS; run++) {
+        bench->vtable->run(&keys.vtable, iv, 0, buffer, AES_BENCH_SIZE);
+    }
+    uint32_t cycles = (bench_cycles() - start) / AES_BENCH_RUNS;
+
+    report(bench->name, AES_BENCH_SIZE, cycles, code_size(bench->prefixes));
+}
+
+static void bench_sha256(uint32_t size) {
+    br_sha256_context sha256;
+    unsigned char hash[32];
+
+    uint32_t start = bench_cycles();
+    br_sha256_init(&sha256);
+    br_sha256_update(&sha256, buffer, size);
+    br_sha256_out(&sha256, hash);
+    uint32_t cycles = bench_cycles() - start;
+
+    report("sha256", size, cycles, code_size(sha_prefixes));
+}
+
+static void bench_ecdsa(const ecdsa_bench* bench) {
+    br_ec_public_key pk = {BR_EC_secp256r1, (unsigned char*)bench_q,
+                           sizeof(bench_q)};
+
+    uint32_t start = bench_cycles();
+    uint32_t valid = bench->vrfy(bench->impl, bench_hash, sizeof(bench_hash),
+                                 &pk, bench_sig, sizeof(bench_sig));
+    uint32_t cycles = bench_cycles() - start;
+
+    // A verify that fails proves nothing about its speed
+    if (!valid) {
+        uart_write_str(UART2, "{\"bench\":\"");
+        uart_write_str(UART2, (char*)bench->name);
+        uart_write_str(UART2, "\",\"error\":\"verify failed\"}\n");
+        return;
+    }
+
+    report(bench->name, sizeof(bench_hash), cycles,
+           code_size(bench->prefixes));
+}
+
+int main(void) {
+    uart_init(UART2);
+    systick_init();
+    systick_period = SysCtlClockGet() / 1000;
+
+    for (uint32_t i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = (unsigned char)(i * 131 + 7);
+    }
+
+    uart_write_str(UART2, "{\"clock\":");
+    write_number(SysCtlClockGet());
+    uart_write_str(UART2, "}\n");
+
+    for (size_t i = 0; i < sizeof(cbcdec_benches) / sizeof(cbcdec_benches[0]);
+         i++) {
+        bench_cbcdec(&cbcdec_benches[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(ctr_benches) / sizeof(ctr_benches[0]); i++) {
+        bench_ctr(&ctr_benches[i]);
+    }
+
+    for (size_t i = 0;
+         i < sizeof(sha_bench_sizes) / sizeof(sha_bench_sizes[0]); i++) {
+        bench_sha256(sha_bench_sizes[i]);
+    }
+
+    for (size_t i = 0; i < sizeof(ecdsa_benches) / sizeof(ecdsa_benches[0]);
+         i++) {
+        bench_ecdsa(&ecdsa_benches[i]);
+    }
+
+    uart_write_str(UART2, "{\"done\":true}\n");
+
+    // QEMU exits on reset when run with -no-reboot
+    SysCtlReset();
+    while (1) {
+    }
+}
@@ -1,42 +1,66 @@
-// Hardware Imports
-#include "inc/hw_ints.h"   // Interrupt numbers
-#include "inc/hw_memmap.h" // Peripheral Base Addresses
-#include "inc/hw_types.h"  // Boolean type
-#include "inc/lm3s6965.h"  // Peripheral Bit Masks and Registers
-
-// Driver API Imports
-#include "driverlib/flash.h"     // FLASH API
-#include "driverlib/interrupt.h" // Interrupt API
-#include "driverlib/sysctl.h"    // System control API (clock/reset)
-
 // Library Imports
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 // Application Imports
 #include "../crypto/secrets.h"
+#include "flash.h"
+#include "hal.h"
+#include "journal.h"
+#include "lzss.h"
+#include "profile.h"
+#include "record.h"
 #include "structures.h"
+#include "trace.h"
 #include "utility.h"
 
 // Forward Declarations
 void load_initial_firmware(void);
-void load_metadata(metadata* mdata);
+uint8_t load_metadata(metadata* mdata, br_sha256_context* sha256);
 void load_firmware(void);
-void decrypt_firmware(metadata* mdata);
+void load_delta_header(metadata* mdata, delta_header* delta,
+                       br_sha256_context* sha256);
+void load_compression_header(metadata* mdata, compression_header* compression,
+                             br_sha256_context* sha256);
+void load_chain_head(br_sha256_context* sha256);
+uint32_t receive_firmware(const uint8_t* identity, uint32_t expected_len);
+void authenticate_frame(uint16_t frame_length);
+void stage_page(uint32_t page_addr, unsigned int data_len);
+void decrypt_and_write_firmware(metadata* mdata, uint32_t staged_len);
+void apply_delta(metadata* mdata, delta_header* delta);
+void decompress_and_write_firmware(metadata* mdata,
+                                   compression_header* compression,
+                                   uint32_t staged_len);
+void load_image_signature(br_sha256_context* sha256);
+void write_device_metadata(metadata* mdata);
+void hash_image(uint32_t size, uint32_t message_size, uint8_t* digest);
+record_header* build_record(uint16_t version, uint32_t size,
+                            uint16_t message_size, uint16_t flags,
+                            const uint8_t* signature, uint32_t installs);
+void record_mac(const record_header* record, uint8_t* mac);
+void seal_record(record_header* record);
+const record_header* installed_record(void);
+uint16_t installed_version(void);
+int check_boot_record(void);
+int initial_image_matches(uint32_t size, uint32_t message_size);
+void report_flash_stats(void);
+void negotiate_baud(void);
+int vector_table_valid(uint32_t size);
 void boot_firmware(void);
-long program_flash(uint32_t, unsigned char*, unsigned int);
+void host_read(uint8_t* dst, size_t n, uint32_t since, const char* state);
 
 // Firmware Constants
-#define METADATA_BASE                                                          \
-    0xFC00              // base address of version and firmware size in Flash
+#define METADATA_BASE RECORD_ADDRESS // device record, see record.h
 #define FW_BASE 0x10000 // base address of firmware in Flash
-
-// FLASH Constants
-#define FLASH_PAGESIZE 1024
-#define FLASH_WRITESIZE 4
+#define FW_SLOT_SIZE 0x18000 // flash reserved for the installed image
+#define STAGING_BASE                                                           \
+    (FW_BASE + FW_SLOT_SIZE) // encrypted image is staged here during updates
+#define SRAM_START 0x20000000 // the firmware's initial stack pointer must
+#define SRAM_END 0x20010000   // point into SRAM
 
 // Protocol Constants
 #define OK ((uint16_t)('O'))
@@ -46,35 +70,99 @@ long program_flash(uint32_t, unsigned char*, unsigned int);
 #define META ((uint16_t)('M'))
 #define FIRM ((uint16_t)('C'))
 #define DONE ((uint16_t)('D'))
+#define WINDOW ((uint16_t)('W'))
+#define PATCH ((uint16_t)('P'))
+#define COMPRESSED ((uint16_t)('Z'))
+#define ACK ((uint16_t)('A'))
+#define RATE ((uint16_t)('R'))
+#define SYNC ((uint16_t)('S'))
+#define CONTAINER ((uint16_t)('V'))
+#define QUERY ((uint16_t)('Q'))
 #define FRAME_SIZE ((uint16_t)(256))
 
+// Leads the data an image signature covers, so it can never be mistaken for
+// an update signature
+#define IMAGE ((uint8_t)('I'))
+
+// Every frame is followed by the hash of the rest of the chain, see
+// authenticate_frame
+#define CHAIN_LINK_SIZE 32
+
+// Windowed transfers prefix each frame with a sequence number and length.
+// Every frame the host may have in flight, with its chain link, has to fit in
+// the UART1 ring.
+#define FRAME_HEADER_SIZE 4
+#define MAX_WINDOW                                                             \
+    (UART_RX_RING_SIZE / (FRAME_HEADER_SIZE + FRAME_SIZE + CHAIN_LINK_SIZE))
+
+// Code runs from flash, so the core stalls while a page is erased or
+// programmed and UART1_IRQHandler cannot drain the 16 byte hardware FIFO.
+// Nothing may be in flight then, whatever the size of the ring: the window is
+// at most a page of frames, and ACKs are held back so the host's credit ends
+// with the frame that completes the page being filled. QEMU does not model
+// the stall.
+#define FRAMES_PER_PAGE (FLASH_PAGESIZE / FRAME_SIZE)
+
+// Once a packet has started, the rest of it must arrive within this many ms
+#define READ_TIMEOUT 1000
+
+// Once an update has started, the host has this many ms to begin each step.
+// A host that goes quiet for longer aborts the update instead of leaving the
+// bootloader waiting for it forever.
+#define HOST_TIMEOUT 10000
+
+// After a rate switch the host has this many ms to confirm the new rate. A
+// negotiated rate is dropped again once the host has been quiet for
+// BAUD_IDLE_TIMEOUT ms, in case the host missed the confirmation and fell
+// back on its own.
+#define BAUD_CONFIRM_TIMEOUT 1000
+#define BAUD_IDLE_TIMEOUT 5000
+
 // Firmware v2 is embedded in bootloader
 // Read up on these symbols in the objcopy man page (if you want)!
 extern int _binary_firmware_bin_start;
 extern int _binary_firmware_bin_size;
 
-// Device metadata
-uint16_t* fw_version_address = (uint16_t*)METADATA_BASE;
-uint16_t* fw_size_address = (uint16_t*)(METADATA_BASE + 2);
-uint8_t* fw_release_message_address;
+// Device record being built or resealed, word aligned for its fields
+uint32_t record_page[RECORD_PAGE_SIZE / sizeof(uint32_t)];
 
-// unsigned char firmware[MAX_FIRMWARE_SIZE];
+// Release message of the firmware embedded in the bootloader
+static const char initial_msg[] = "This is the initial release message.";
+
+// Signature over the image being installed, kept in its boot record
+uint8_t image_signature[SIGNATURE_SIZE];
+
+// Page buffer: holds received data until it is staged, and decrypted data
+// until it is installed
 unsigned char data[FLASH_PAGESIZE];
-unsigned char firmware[MAX_FIRMWARE_SIZE];
+// Decompressed data waiting to be installed
+unsigned char page_out[FLASH_PAGESIZE];
+unsigned char frame[FRAME_SIZE];
+
+// chain_next holds the hash the next frame must match, starting at the signed
+// head of the chain
+uint8_t chain_next[CHAIN_LINK_SIZE];
+uint8_t chain_link[CHAIN_LINK_SIZE];
 
 // Setup the bootloader for communication
 void init_interfaces() {
     // The interrupt handler listens to UART0 for RESET interrupts
     uart_init(UART0);
-    IntEnable(INT_UART0);
-    IntMasterEnable();
+    hal_init();
+
+    // SysTick provides the time base for UART timeouts
+    systick_init();
 
-    // UART1 is used for input
+    // UART1 is used for input, received bytes are buffered by its interrupt
     uart_init(UART1);
+    uart_rx_init();
 
     // UART2 is used for output
     uart_init(UART2);
 
+    // Only does something in PROFILE builds
+    PROFILE_INIT();
+
     // We need something to boot to so we use a firmware embedded in the
     // bootloader
     load_initial_firmware();
@@ -91,10 +179,23 @@ int main(void) {
     // initialize UARTs
     init_interfaces();
 
-    int read;
+    uint8_t request;
     while (true) {
-        uint16_t request = uart_read(UART1, BLOCKING, &read);
+        uint32_t timeout = uart_get_baud() == UART_DEFAULT_BAUD
+                               ? UART_WAIT_FOREVER
+                               : BAUD_IDLE_TIMEOUT;
+        if (uart_read_bulk(&request, 1, timeout) != 1) {
+            uart_write_str(UART2, "[BAUD] Host is quiet, using default rate\n");
+            uart_set_baud(UART_DEFAULT_BAUD);
+            uart_rx_flush();
+            continue;
+        }
+
         switch (request) {
+        case RATE:
+            negotiate_baud();
+            break;
+
         case UPDATE:
             uart_write_str(UART2,
                            "[UPDATE] Received a request to update firmware.\n");
@@ -110,52 +211,94 @@ int main(void) {
     }
 }
 
-void load_metadata(metadata* mdata) {
-    // Wait until we receive a metadata header
-    int read;
-    while (true) {
-        uint16_t request = uart_read(UART1, BLOCKING, &read);
-        if (request == META)
-            break;
+// read the signature and metadata of an update in either format, echo the
+// metadata and add it to the signed hash. Returns the payload type.
+uint8_t load_metadata(metadata* mdata, br_sha256_context* sha256) {
+    // Wait until we receive a metadata header, PATCH announces a delta,
+    // COMPRESSED a compressed image and CONTAINER a v2 container of any of
+    // them
+    uint8_t request = 0;
+    uint32_t since = systick_ms();
+    while (request != META && request != PATCH && request != COMPRESSED &&
+           request != CONTAINER) {
+        host_read(&request, 1, since, "METADATA");
     }
 
     // Acknowledge that we are about to receive metadata
-    uart_write_str(UART2, "[METADATA] META packet received\n");
+    uart_write_str(UART2, "[METADATA] Header received: ");
+    uart_write(UART2, request);
+    nl(UART2);
     uart_write(UART1, OK);
 
-    // Start reading in information about our metadata
-    uart_read_wrp(UART1, BLOCKING, &read, mdata->signature, SIGNATURE_SIZE);
-    uart_read_wrp(UART1, BLOCKING, &read, (uint8_t*)(&mdata->version),
-                  sizeof(uint16_t));
-    uart_read_wrp(UART1, BLOCKING, &read, (uint8_t*)(&mdata->size),
-                  sizeof(uint16_t));
-    uart_read_wrp(UART1, BLOCKING, &read, (uint8_t*)(&mdata->message_size),
-                  sizeof(uint16_t));
+    if (uart_read_bulk(mdata->signature, SIGNATURE_SIZE, READ_TIMEOUT) !=
+        SIGNATURE_SIZE)
+        reject();
+
+    // Everything but a v1 image is signed with its header byte in front, so
+    // a signature can never be replayed as another payload type or format
+    if (request != META)
+        br_sha256_update(sha256, &request, 1);
 
-    uart_write_str(UART2, "[METADATA] Version: ");
+    uint8_t type = request;
+    if (request == CONTAINER) {
+        container_header header;
+        if (uart_read_bulk((uint8_t*)&header, sizeof(header), READ_TIMEOUT) !=
+            sizeof(header))
+            reject();
+
+        // Anything this bootloader does not fully understand is refused
+        // before any of it is used
+        uint32_t reserved = header.pad;
+        for (int i = 0; i < CONTAINER_RESERVED_SIZE; i++)
+            reserved |= header.reserved[i];
+        if (header.magic != CONTAINER_MAGIC ||
+            header.format != CONTAINER_FORMAT || reserved ||
+            (header.payload != META && header.payload != PATCH &&
+             header.payload != COMPRESSED)) {
+            uart_write_str(UART2, "[METADATA] Unknown container format\n");
+            reject();
+        }
+
+        br_sha256_update(sha256, &header, sizeof(header));
+        uart_write_bulk(UART1, (uint8_t*)&header, sizeof(header));
+
+        type = header.payload;
+        mdata->version = header.version;
+        mdata->size = header.size;
+        mdata->message_size = header.message_size;
+    } else {
+        metadata_v1 header;
+        if (uart_read_bulk((uint8_t*)&header, sizeof(header), READ_TIMEOUT) !=
+            sizeof(header))
+            reject();
+
+        br_sha256_update(sha256, &header, sizeof(header));
+        uart_write_bulk(UART1, (uint8_t*)&header, sizeof(header));
+
+        mdata->version = header.version;
+        mdata->size = header.size;
+        mdata->message_size = header.message_size;
+    }
 
-    // get metadata information and send to fw_update and debug
-    // get rid of debugging here?
-    char buffer[5];
+    // get metadata information for debug
+    char buffer[11];
+    uart_write_str(UART2, "[METADATA] Version: ");
     itoa(mdata->version, buffer, 10);
     uart_write_str(UART2, buffer);
-    uart_write_wrp(UART1, (uint8_t*)(&mdata->version), sizeof(uint16_t));
     nl(UART2);
 
     uart_write_str(UART2, "[METADATA] Size: ");
     itoa(mdata->size, buffer, 10);
     uart_write_str(UART2, buffer);
-    uart_write_wrp(UART1, (uint8_t*)(&mdata->size), sizeof(uint16_t));
     nl(UART2);
 
     uart_write_str(UART2, "[METADATA] Message size: ");
     itoa(mdata->message_size, buffer, 10);
     uart_write_str(UART2, buffer);
-    uart_write_wrp(UART1, (uint8_t*)(&mdata->message_size), sizeof(uint16_t));
     nl(UART2);
 
     // Prevent rollbacks except for debug binaries
-    uint16_t old_version = *fw_version_address;
+    uint16_t old_version = installed_version();
     if (mdata->version != 0 && mdata->version < old_version) {
         uart_write_str(UART1, "[METADATA] Version not supported\n");
         reject();
@@ -173,56 +316,269 @@ void load_metadata(metadata* mdata) {
     }
 
     uart_write_str(UART2, "[METADATA] Loaded metadata succesfully\n");
+    return type;
 }
 
 void load_firmware() {
+    PROFILE_RESET();
+    PROFILE_START(PROFILE_UPDATE);
+
     // Tell our update tool we are ready!
     uart_write(UART1, OK);
 
+    // An initalized context is needed for hash functions
+    br_sha256_context sha256 = {0};
+    br_sha256_init(&sha256);
+
     // We don't want to proceed if we have no metadata...
     metadata mdata;
     memset(&mdata, 0x0, sizeof(metadata));
-    load_metadata(&mdata);
+    PROFILE_START(PROFILE_METADATA);
+    uint8_t type = load_metadata(&mdata, &sha256);
+    PROFILE_STOP(PROFILE_METADATA);
 
     // Something went wrong trying to retrieve our data..
     if (!mdata.size) {
         uart_write_str(UART2, "[FIRMWARE] Failed to load firmware\n");
-        SysCtlReset();
+        hal_reset();
     }
 
-    // An initalized context is needed for hash functions
-    br_sha256_context sha256 = {0};
-    br_sha256_init(&sha256);
-    // uart_write_str(UART2, "[FIRMWARE] Initalized SHA256 hash\n");
+    // Every update carries a signature over the plain image for boot time
+    load_image_signature(&sha256);
+
+    // A delta lists the pages it replaces and the digests of the pages it
+    // keeps, which must match what is in flash right now
+    delta_header delta;
+    compression_header compression;
+    uint32_t expected_len;
+    if (type == PATCH) {
+        load_delta_header(&mdata, &delta, &sha256);
+        expected_len = (uint32_t)delta.changed_count * FLASH_PAGESIZE;
+    } else if (type == COMPRESSED) {
+        // The ciphertext is the compressed image, PKCS#7 padded
+        load_compression_header(&mdata, &compression, &sha256);
+        expected_len = (compression.compressed_size / 16 + 1) * 16;
+    } else {
+        // The ciphertext is the image plus its release message, PKCS#7 padded
+        uint32_t image_len = mdata.size + mdata.message_size + 1;
+        expected_len = (image_len / 16 + 1) * 16;
+    }
 
-    // Update our SHA256 hash with our current metadata
-    br_sha256_update(&sha256, &mdata.version, sizeof(uint16_t));
-    br_sha256_update(&sha256, &mdata.size, sizeof(uint16_t));
-    br_sha256_update(&sha256, &mdata.message_size, sizeof(uint16_t));
+    // The signature covers everything up to the head of the frame chain, so
+    // it is checked before a single frame is accepted
+    load_chain_head(&sha256);
 
     uint8_t hash[32] = {0};
     br_sha256_out(&sha256, hash);
 
-    // Wait for firmware header to be sent
-    int read;
-    while (true) {
-        uint16_t request = uart_read(UART1, BLOCKING, &read);
-        if (request == FIRM)
-            break;
+    // verify the hash with the public key
+    PROFILE_START(PROFILE_VERIFY);
+    if (!verify_signature(hash, mdata.signature))
+        reject();
+    PROFILE_STOP(PROFILE_VERIFY);
+
+    // The signed digest names the update in the progress journal
+    uint32_t staged_len = receive_firmware(hash, expected_len);
+    if (staged_len != expected_len) {
+        uart_write_str(UART2, "[FIRMWARE] Firmware length mismatch\n");
+        reject();
+    }
+
+    uart_write_str(UART2, "[FIRMWARE] Updating firmware ...\n");
+
+    // Count only the pages written by the install itself
+    flash_reset_stats();
+
+    // no need to check the return type, the device will reset if this fails
+    if (type == PATCH)
+        apply_delta(&mdata, &delta);
+    else if (type == COMPRESSED)
+        decompress_and_write_firmware(&mdata, &compression, staged_len);
+    else
+        decrypt_and_write_firmware(&mdata, staged_len);
+
+    report_flash_stats();
+
+    // Until here a reset resumes the update, or installs it again from the
+    // staging slot if every page had arrived
+    journal_clear();
+
+    uart_write(UART1, OK);
+
+    // Nothing may come between this line and the profile report
+    TRACE_FLUSH();
+    uart_write_str(UART2, "[FIRMWARE] Ready to boot!\n");
+
+    // The binary report follows the last line of text
+    PROFILE_STOP(PROFILE_UPDATE);
+    PROFILE_REPORT(UART2);
+}
+
+// read a delta header and check the pages it keeps against flash
+void load_delta_header(metadata* mdata, delta_header* delta,
+                       br_sha256_context* sha256) {
+    if (uart_read_bulk((uint8_t*)delta, sizeof(delta_header), READ_TIMEOUT) !=
+        sizeof(delta_header))
+        reject();
+    br_sha256_update(sha256, delta, sizeof(delta_header));
+
+    // The delta has to describe every page of the new image, and no more
+    uint32_t image_len = mdata->size + mdata->message_size + 1;
+    uint32_t page_count = (image_len + FLASH_PAGESIZE - 1) / FLASH_PAGESIZE;
+    if (delta->page_count != page_count ||
+        page_count > FW_SLOT_SIZE / FLASH_PAGESIZE) {
+        uart_write_str(UART2, "[DELTA] Page count mismatch\n");
+        reject();
+    }
+
+    uint16_t changed_count = 0;
+    for (uint16_t i = 0; i < DELTA_BITMAP_SIZE * 8; i++) {
+        if (!DELTA_PAGE_CHANGED(delta, i))
+            continue;
+        if (i >= page_count)
+            reject();
+        changed_count++;
+    }
+    if (changed_count != delta->changed_count)
+        reject();
+
+    // Digests of the kept pages follow in page order. They are part of the
+    // signed data, so a match here means flash holds the base the delta was
+    // made against.
+    uint8_t expected[32];
+    uint8_t actual[32];
+    br_sha256_context page_hash;
+    for (uint16_t i = 0; i < page_count; i++) {
+        if (DELTA_PAGE_CHANGED(delta, i))
+            continue;
+
+        if (uart_read_bulk(expected, sizeof(expected), READ_TIMEOUT) !=
+            sizeof(expected))
+            reject();
+        br_sha256_update(sha256, expected, sizeof(expected));
+
+        br_sha256_init(&page_hash);
+        br_sha256_update(&page_hash, HAL_FLASH(FW_BASE + i * FLASH_PAGESIZE),
+                         FLASH_PAGESIZE);
+        br_sha256_out(&page_hash, actual);
+
+        if (memcmp(expected, actual, sizeof(actual)) != 0) {
+            uart_write_str(UART2, "[DELTA] Installed firmware does not match "
+                                  "the delta base\n");
+            reject();
+        }
+    }
+
+    uart_write_str(UART2, "[DELTA] Base firmware verified\n");
+}
+
+// read the signature over the plain image
+void load_image_signature(br_sha256_context* sha256) {
+    if (uart_read_bulk(image_signature, SIGNATURE_SIZE, READ_TIMEOUT) !=
+        SIGNATURE_SIZE)
+        reject();
+    br_sha256_update(sha256, image_signature, SIGNATURE_SIZE);
+}
+
+// read the sizes of a compressed image
+void load_compression_header(metadata* mdata, compression_header* compression,
+                             br_sha256_context* sha256) {
+    if (uart_read_bulk((uint8_t*)compression, sizeof(compression_header),
+                       READ_TIMEOUT) != sizeof(compression_header))
+        reject();
+    br_sha256_update(sha256, compression, sizeof(compression_header));
+
+    // It has to decompress to exactly the image and its release message
+    uint32_t image_len = mdata->size + mdata->message_size + 1;
+    if (compression->uncompressed_size != image_len ||
+        compression->compressed_size > FW_SLOT_SIZE - 16) {
+        uart_write_str(UART2, "[FIRMWARE] Compressed size not supported\n");
+        reject();
+    }
+}
+
+// read the head of the frame chain, the hash the first frame must match
+void load_chain_head(br_sha256_context* sha256) {
+    if (uart_read_bulk(chain_next, CHAIN_LINK_SIZE, READ_TIMEOUT) !=
+        CHAIN_LINK_SIZE)
+        reject();
+    br_sha256_update(sha256, chain_next, CHAIN_LINK_SIZE);
+}
+
+// receive firmware frames into the staging slot, returning the staged length
+uint32_t receive_firmware(const uint8_t* identity, uint32_t expected_len) {
+    uint32_t staged_len = 0; // bytes written to the staging slot so far
+    int resumed = 0;
+
+    // Wait for firmware header to be sent. FIRM starts a stop-and-wait
+    // transfer, WINDOW starts a windowed transfer and carries the number of
+    // frames the host wants to keep in flight. QUERY asks how much of this
+    // update was staged before an interruption, the transfer continues from
+    // there.
+    uint8_t request = 0;
+    uint32_t since = systick_ms();
+    while (request != FIRM && request != WINDOW) {
+        host_read(&request, 1, since, "FIRMWARE");
+        if (request != QUERY || resumed)
+            continue;
+
+        uint32_t journal_len;
+        if (journal_resume(identity, &journal_len, chain_link) &&
+            journal_len <= expected_len && !(journal_len % FLASH_PAGESIZE)) {
+            staged_len = journal_len;
+            memcpy(chain_next, chain_link, CHAIN_LINK_SIZE);
+            uart_write_str(UART2, "[FIRMWARE] Resuming interrupted update\n");
+        }
+        resumed = 1;
+
+        uart_write(UART1, OK);
+        uart_write_bulk(UART1, (uint8_t*)&staged_len, sizeof(uint32_t));
     }
 
-    // Acknowledge that we are about to receive firmware
+    if (!staged_len && journal_start(identity))
+        reject();
+
+    uint8_t window = 0;
+    if (request == WINDOW) {
+        if (uart_read_bulk(&window, 1, READ_TIMEOUT) != 1 || !window)
+            reject();
+        if (window > MAX_WINDOW)
+            window = MAX_WINDOW;
+        if (window > FRAMES_PER_PAGE)
+            window = FRAMES_PER_PAGE;
+    }
+
+    // Acknowledge that we are about to receive firmware, and tell a windowed
+    // sender how many frames it may actually have in flight
     uart_write_str(UART2, "[FIRMWARE] FIRM packet received\n");
     uart_write(UART1, OK);
+    if (window)
+        uart_write(UART1, window);
 
     // begin receiving firmware
     uint16_t frame_length = 0;
-    uint32_t data_index = 0;
+    uint16_t seq = staged_len / FRAME_SIZE; // next windowed frame
+    uint16_t acked = seq; // last cumulative ACK sent
+    uint16_t page_fill = 0; // bytes waiting in the page buffer
 
     while (true) {
-        uart_write_str(UART2, "[FIRMWARE] Waiting for new frame.\n");
-        uart_read_wrp(UART1, BLOCKING, &read, (uint8_t*)(&frame_length), 2);
-        uart_write_str(UART2, "[FIRMWARE] Frame received\n");
+        TRACE1(TRACE_FRAME_WAIT, staged_len + page_fill);
+
+        // Frames arrive in order over UART, so a sequence number we don't
+        // expect means the stream is corrupt
+        if (window) {
+            uint16_t frame_seq;
+            host_read((uint8_t*)(&frame_seq), 2, systick_ms(), "FRAMES");
+            if (frame_seq != seq)
+                reject();
+
+            if (uart_read_bulk((uint8_t*)(&frame_length), 2, READ_TIMEOUT) != 2)
+                reject();
+        } else {
+            host_read((uint8_t*)(&frame_length), 2, systick_ms(), "FRAMES");
+        }
+        PROFILE_START(PROFILE_FRAME);
+        TRACE2(TRACE_FRAME_RECEIVED, staged_len + page_fill, frame_length);
 
         // Make sure we are't reading more than our frame size
         if (frame_length > FRAME_SIZE) {
@@ -233,41 +589,121 @@ void load_firmware() {
 
         // We aren't reading anymore data
         if (!frame_length) {
+            // The last frame links to an all zero hash, anything else means
+            // frames are missing from the end
+            for (int i = 0; i < CHAIN_LINK_SIZE; i++) {
+                if (chain_next[i]) {
+                    uart_write_str(UART2, "[FIRMWARE] Firmware truncated\n");
+                    reject();
+                }
+            }
+
+            // Stage whatever is left of the final page
+            if (page_fill) {
+                stage_page(STAGING_BASE + staged_len, page_fill);
+                staged_len += page_fill;
+            }
+
             uart_write(UART1, OK);
             uart_write_str(UART2, "[FIRMWARE] End of firmware reached.\n");
             break;
         }
 
-        // Update the current SHA256 hash with the data we just received
-        uart_read_wrp(UART1, BLOCKING, &read, firmware + data_index,
-                      frame_length);
-        br_sha256_update(&sha256, firmware + data_index, frame_length);
-        data_index += frame_length;
-        // Let fw_update.py know that we've received the packet and processed it
-        uart_write(UART1, OK);
-    }
+        // The staging slot is the same size as the firmware slot
+        if (staged_len + page_fill + frame_length > FW_SLOT_SIZE) {
+            uart_write_str(UART2, "[FIRMWARE] Firmware does not fit in flash\n");
+            reject();
+        }
 
-    // calculate the hash
-    br_sha256_out(&sha256, hash);
+        if (uart_read_bulk(frame, frame_length, READ_TIMEOUT) != frame_length)
+            reject();
+        authenticate_frame(frame_length);
+
+        // Move the frame into the page buffer, staging every page we fill
+        uint16_t copied = 0;
+        while (copied < frame_length) {
+            uint16_t count = frame_length - copied;
+            if (count > FLASH_PAGESIZE - page_fill)
+                count = FLASH_PAGESIZE - page_fill;
+
+            memcpy(data + page_fill, frame + copied, count);
+            page_fill += count;
+            copied += count;
+
+            if (page_fill == FLASH_PAGESIZE) {
+                stage_page(STAGING_BASE + staged_len, FLASH_PAGESIZE);
+                staged_len += FLASH_PAGESIZE;
+                page_fill = 0;
+            }
+        }
+
+        // Progress is journaled whenever a frame completes a page, with the
+        // link the next frame has to match
+        if (!page_fill) {
+            if (journal_commit(staged_len, chain_next))
+                reject();
+            TRACE1(TRACE_JOURNAL_COMMIT, staged_len);
+        }
 
-    // verify the hash with ECDSA and public key
-    bool status = br_ecdsa_i31_vrfy_raw(&br_ec_p256_m31, hash, 32, &EC_PUBLIC,
-                                        &mdata.signature, SIGNATURE_SIZE);
+        // Let fw_update.py know that we've received the packet and processed
+        // it. Windowed transfers get a cumulative ACK of the next sequence
+        // number we expect, held back so that the host never sends past the
+        // frame that completes the page being filled before it is staged.
+        // The last page is only staged after the zero length frame, so its
+        // frames are acknowledged right away.
+        if (window) {
+            seq++;
+            uint16_t limit =
+                staged_len / FRAME_SIZE + FRAMES_PER_PAGE - window;
+            if (limit > seq || staged_len + FLASH_PAGESIZE >= expected_len)
+                limit = seq;
+            if (limit > acked) {
+                acked = limit;
+                uart_write(UART1, ACK);
+                uart_write_bulk(UART1, (uint8_t*)(&acked), sizeof(uint16_t));
+            }
+        } else {
+            uart_write(UART1, OK);
+        }
+        PROFILE_STOP(PROFILE_FRAME);
+    }
+
+    return staged_len;
+}
 
-    if (!status)
+// check a received frame against the chain: its data and the link that
+// follows it must hash to chain_next, and the link is what the next frame
+// must hash to. A bad frame is refused before any of it reaches flash.
+void authenticate_frame(uint16_t frame_length) {
+    if (uart_read_bulk(chain_link, CHAIN_LINK_SIZE, READ_TIMEOUT) !=
+        CHAIN_LINK_SIZE)
         reject();
 
-    uart_write_str(UART2, "[FIRMWARE] Updating firmware ...\n");
+    uint8_t hash[32];
+    br_sha256_context sha256;
+    PROFILE_START(PROFILE_SHA256);
+    br_sha256_init(&sha256);
+    br_sha256_update(&sha256, frame, frame_length);
+    br_sha256_update(&sha256, chain_link, CHAIN_LINK_SIZE);
+    br_sha256_out(&sha256, hash);
+    PROFILE_STOP(PROFILE_SHA256);
 
-    // no need to check the return type, the device will reset if this fails
-    decrypt_and_write_firmware(&mdata);
+    if (memcmp(hash, chain_next, sizeof(hash)) != 0) {
+        uart_write_str(UART2, "[FIRMWARE] Frame failed authentication\n");
+        reject();
+    }
+    memcpy(chain_next, chain_link, CHAIN_LINK_SIZE);
+}
 
-    uart_write(UART1, OK);
-    uart_write_str(UART2, "[FIRMWARE] Ready to boot!\n");
+// write a page of authenticated ciphertext to the staging slot
+void stage_page(uint32_t page_addr, unsigned int data_len) {
+    if (flash_write_page(page_addr, data, data_len))
+        reject();
+    TRACE2(TRACE_PAGE_STAGED, page_addr, data_len);
 }
 
-// decrypt firmware with AES and write to flash
-void decrypt_and_write_firmware(metadata* mdata) {
+// decrypt the staged firmware with AES and commit it to flash page by page
+void decrypt_and_write_firmware(metadata* mdata, uint32_t staged_len) {
     // initialization for AES
     const br_block_cbcdec_class* vd = &br_aes_big_cbcdec_vtable;
     br_aes_gen_cbcdec_keys v_dc;
@@ -276,79 +712,368 @@ void decrypt_and_write_firmware(metadata* mdata) {
     dc = &v_dc.vtable;
     vd->init(dc, AES_KEY, AES_KEY_LENGTH);
 
-    size_t chunks = mdata->size / FLASH_PAGESIZE;
-    size_t remainder = mdata->size % FLASH_PAGESIZE;
-    uint32_t page = FW_BASE;
+    // CBC updates the IV as it goes, so work on a copy of it
+    uint8_t iv[IV_KEY_LENGTH];
+    memcpy(iv, IV_KEY, IV_KEY_LENGTH);
+
+    // Only the image and its null-terminated message are installed, the
+    // padding is dropped
+    uint32_t image_len = mdata->size + mdata->message_size + 1;
+
+    // Don't reset the device while we are writing pages
+    hal_irq_disable();
 
-    // Don't reset the device while we are decrypting pages
-    IntMasterDisable();
+    for (uint32_t offset = 0; offset < image_len; offset += FLASH_PAGESIZE) {
+        uint32_t page = FW_BASE + offset;
+        uint32_t chunk = staged_len - offset;
+        if (chunk > FLASH_PAGESIZE)
+            chunk = FLASH_PAGESIZE;
 
-    // Copy full chunks
-    for (size_t i = 0; i < chunks; i++, page += FLASH_PAGESIZE) {
-        // run AES
-        vd->run(dc, IV_KEY, firmware + (i * FLASH_PAGESIZE), FLASH_PAGESIZE);
+        uint32_t write_len = image_len - offset;
+        if (write_len > FLASH_PAGESIZE)
+            write_len = FLASH_PAGESIZE;
+
+        // run AES on the staged page
+        memcpy(data, HAL_FLASH(STAGING_BASE + offset), chunk);
+        PROFILE_START(PROFILE_AES);
+        vd->run(dc, iv, data, chunk);
+        PROFILE_STOP(PROFILE_AES);
 
         // check for errors
-        if (program_flash(page, firmware + (i * FLASH_PAGESIZE),
-                          FLASH_PAGESIZE))
+        if (flash_write_page(page, data, write_len))
             reject();
+    }
 
-        if (memcmp(firmware + (i * FLASH_PAGESIZE), (void*)(page),
-                   FLASH_PAGESIZE) != 0)
-            reject();
+    write_device_metadata(mdata);
 
-    }
+    hal_irq_enable();
+    uart_write_str(UART2, "[FIRMWARE] Firmware installed.\n");
+}
+
+// decrypt the staged pages of a delta and write them over the pages they
+// replace, leaving every other page alone
+void apply_delta(metadata* mdata, delta_header* delta) {
+    // initialization for AES
+    const br_block_cbcdec_class* vd = &br_aes_big_cbcdec_vtable;
+    br_aes_gen_cbcdec_keys v_dc;
+    const br_block_cbcdec_class** dc;
+
+    dc = &v_dc.vtable;
+    vd->init(dc, AES_KEY, AES_KEY_LENGTH);
+
+    // The changed pages are encrypted back to back as one CBC stream
+    uint8_t iv[IV_KEY_LENGTH];
+    memcpy(iv, IV_KEY, IV_KEY_LENGTH);
+
+    // Don't reset the device while we are writing pages
+    hal_irq_disable();
+
+    uint32_t staged = STAGING_BASE;
+    for (uint16_t i = 0; i < delta->page_count; i++) {
+        if (!DELTA_PAGE_CHANGED(delta, i))
+            continue;
 
-    // Copy remaining bytes
-    if (remainder > 0) {
-        vd->run(dc, IV_KEY, firmware + (chunks * FLASH_PAGESIZE),
-                FLASH_PAGESIZE);
+        uint32_t page = FW_BASE + i * FLASH_PAGESIZE;
 
-        if (program_flash(page, firmware + (chunks * FLASH_PAGESIZE),
-                          FLASH_PAGESIZE))
+        memcpy(data, HAL_FLASH(staged), FLASH_PAGESIZE);
+        PROFILE_START(PROFILE_AES);
+        vd->run(dc, iv, data, FLASH_PAGESIZE);
+        PROFILE_STOP(PROFILE_AES);
+        staged += FLASH_PAGESIZE;
+
+        if (flash_write_page(page, data, FLASH_PAGESIZE))
             reject();
+    }
+
+    write_device_metadata(mdata);
+
+    hal_irq_enable();
+    uart_write_str(UART2, "[DELTA] Changed pages installed.\n");
+}
+
+// decrypt the staged compressed image and decompress it into flash. The
+// decoder assembles one page of output at a time and commits it as soon as
+// it is full.
+void decompress_and_write_firmware(metadata* mdata,
+                                   compression_header* compression,
+                                   uint32_t staged_len) {
+    // initialization for AES
+    const br_block_cbcdec_class* vd = &br_aes_big_cbcdec_vtable;
+    br_aes_gen_cbcdec_keys v_dc;
+    const br_block_cbcdec_class** dc;
+
+    dc = &v_dc.vtable;
+    vd->init(dc, AES_KEY, AES_KEY_LENGTH);
+
+    uint8_t iv[IV_KEY_LENGTH];
+    memcpy(iv, IV_KEY, IV_KEY_LENGTH);
+
+    lzss_decoder lz;
+    lzss_init(&lz, FW_BASE, compression->uncompressed_size, page_out,
+              FLASH_PAGESIZE, flash_write_page);
 
-        if (memcmp(firmware + (chunks * FLASH_PAGESIZE), (void*)(page),
-                   FLASH_PAGESIZE) != 0)
+    // Don't reset the device while we are writing pages
+    hal_irq_disable();
+
+    uint32_t compressed_size = compression->compressed_size;
+    for (uint32_t offset = 0; offset < compressed_size;
+         offset += FLASH_PAGESIZE) {
+        uint32_t chunk = staged_len - offset;
+        if (chunk > FLASH_PAGESIZE)
+            chunk = FLASH_PAGESIZE;
+
+        memcpy(data, HAL_FLASH(STAGING_BASE + offset), chunk);
+        PROFILE_START(PROFILE_AES);
+        vd->run(dc, iv, data, chunk);
+        PROFILE_STOP(PROFILE_AES);
+
+        // Leave out the padding
+        uint32_t feed = compressed_size - offset;
+        if (feed > chunk)
+            feed = chunk;
+
+        PROFILE_START(PROFILE_DECOMPRESS);
+        if (lzss_feed(&lz, data, feed))
             reject();
+        PROFILE_STOP(PROFILE_DECOMPRESS);
     }
 
-    IntMasterEnable();
-    uart_write_str(UART2, "[FIRMWARE] Firmware installed.\n");
+    if (lzss_finish(&lz))
+        reject();
+
+    write_device_metadata(mdata);
+
+    hal_irq_enable();
+    uart_write_str(UART2, "[FIRMWARE] Compressed firmware installed.\n");
+}
+
+// record the installed image in the device record, along with the version
+// and the install count it carries over
+void write_device_metadata(metadata* mdata) {
+    const record_header* installed = installed_record();
+    uint32_t installs =
+        installed ? record_number(installed, RECORD_INSTALL_COUNT) + 1 : 1;
+
+    // Debug binaries (version 0) keep the currently installed version
+    uint16_t version = mdata->version ? mdata->version : installed_version();
+    record_header* record =
+        build_record(version, mdata->size, mdata->message_size,
+                     RECORD_FLAG_SIGNED, image_signature, installs);
+
+    // The image signature has to hold for what actually landed in flash,
+    // otherwise the image could never boot
+    PROFILE_START(PROFILE_VERIFY);
+    if (!verify_signature(record_get(record, RECORD_IMAGE_DIGEST, NULL),
+                          image_signature))
+        reject();
+    PROFILE_STOP(PROFILE_VERIFY);
+
+    seal_record(record);
+}
+
+// digest of the installed image as its image signature covers it
+void hash_image(uint32_t size, uint32_t message_size, uint8_t* digest) {
+    br_sha256_context sha256;
+    br_sha256_init(&sha256);
+
+    uint8_t type = IMAGE;
+    br_sha256_update(&sha256, &type, 1);
+    br_sha256_update(&sha256, &size, sizeof(uint32_t));
+    br_sha256_update(&sha256, &message_size, sizeof(uint32_t));
+    PROFILE_START(PROFILE_SHA256);
+    br_sha256_update(&sha256, HAL_FLASH(FW_BASE), size + message_size + 1);
+    PROFILE_STOP(PROFILE_SHA256);
+    br_sha256_out(&sha256, digest);
+}
+
+// build the record of the image in flash in record_page, with an empty mac
+record_header* build_record(uint16_t version, uint32_t size,
+                            uint16_t message_size, uint16_t flags,
+                            const uint8_t* signature, uint32_t installs) {
+    record_header* record = (record_header*)record_page;
+    record_init(record);
+
+    uint32_t message_address = FW_BASE + size;
+    record_add(record, RECORD_VERSION, &version, sizeof(version));
+    record_add(record, RECORD_IMAGE_SIZE, &size, sizeof(size));
+    hash_image(size, message_size,
+               record_add(record, RECORD_IMAGE_DIGEST, NULL, 32));
+    record_add(record, RECORD_MESSAGE_ADDRESS, &message_address,
+               sizeof(message_address));
+    record_add(record, RECORD_MESSAGE_SIZE, &message_size,
+               sizeof(message_size));
+    record_add(record, RECORD_INSTALL_COUNT, &installs, sizeof(installs));
+    record_add(record, RECORD_FLAGS, &flags, sizeof(flags));
+    if (signature)
+        record_add(record, RECORD_IMAGE_SIGNATURE, signature, SIGNATURE_SIZE);
+    record_add(record, RECORD_SEQUENCE, NULL, sizeof(uint32_t));
+    record_add(record, RECORD_MAC, NULL, 32);
+    return record;
+}
+
+// mac of everything from the format up to the mac value, keyed with
+// RECORD_KEY
+void record_mac(const record_header* record, uint8_t* mac) {
+    const uint8_t* start = (const uint8_t*)&record->format;
+    const uint8_t* end = record_get(record, RECORD_MAC, NULL);
+
+    br_hmac_key_context kc;
+    br_hmac_context hmac;
+    br_hmac_key_init(&kc, &br_sha256_vtable, RECORD_KEY, RECORD_KEY_LENGTH);
+    br_hmac_init(&hmac, &kc, 0);
+    br_hmac_update(&hmac, start, end - start);
+    br_hmac_out(&hmac, mac);
+}
+
+// mac and crc the record, whose digest is already filled in, and write it
+// over the copy that is not current. Until its page is written the current
+// copy stays in effect.
+void seal_record(record_header* record) {
+    const record_header* current = installed_record();
+    uint32_t page = METADATA_BASE;
+    if (current == HAL_FLASH(METADATA_BASE))
+        page += RECORD_PAGE_SIZE;
+
+    uint32_t sequence =
+        current ? record_number(current, RECORD_SEQUENCE) + 1 : 1;
+    memcpy((uint8_t*)record_get(record, RECORD_SEQUENCE, NULL), &sequence,
+           sizeof(sequence));
+    record_mac(record, (uint8_t*)record_get(record, RECORD_MAC, NULL));
+    record_finish(record);
+
+    if (flash_write_page(page, (uint8_t*)record,
+                         sizeof(record_header) + record->area_size))
+        reject();
+}
+
+// the current copy of the device record, NULL if both are missing or damaged
+const record_header* installed_record(void) {
+    const record_header* record =
+        record_newer(HAL_FLASH(METADATA_BASE),
+                     HAL_FLASH(METADATA_BASE + RECORD_PAGE_SIZE));
+    if (!record || !record_get(record, RECORD_MAC, NULL))
+        return NULL;
+    return record;
+}
+
+uint16_t installed_version(void) {
+    const record_header* record = installed_record();
+    return record ? record_number(record, RECORD_VERSION) : 0;
+}
+
+// check the installed image before booting it. A record this bootloader
+// sealed only costs a SHA-256 of the image. Anything else needs the image
+// signature (or the embedded firmware) to vouch for the image, after which
+// the record is sealed again.
+int check_boot_record(void) {
+    const record_header* installed = installed_record();
+    uint16_t length;
+    const uint8_t* stored_digest =
+        installed ? record_get(installed, RECORD_IMAGE_DIGEST, &length) : NULL;
+    if (!stored_digest || length != 32) {
+        uart_write_str(UART2, "[BOOT] No boot record, update the firmware\n");
+        return 0;
+    }
+
+    uint32_t size = record_number(installed, RECORD_IMAGE_SIZE);
+    uint32_t message_size = record_number(installed, RECORD_MESSAGE_SIZE);
+    if (size > MAX_FIRMWARE_SIZE || message_size > MAX_MESSAGE_SIZE ||
+        record_number(installed, RECORD_MESSAGE_ADDRESS) != FW_BASE + size) {
+        uart_write_str(UART2, "[BOOT] Boot record does not fit the slot\n");
+        return 0;
+    }
+
+    uint8_t digest[32];
+    uint8_t mac[32];
+    hash_image(size, message_size, digest);
+    record_mac(installed, mac);
+
+    if (memcmp(mac, record_get(installed, RECORD_MAC, NULL), sizeof(mac)) ==
+            0 &&
+        memcmp(digest, stored_digest, sizeof(digest)) == 0)
+        return 1;
+
+    uart_write_str(UART2, "[BOOT] Boot record is stale, checking image\n");
+
+    int valid = 0;
+    uint32_t flags = record_number(installed, RECORD_FLAGS);
+    const uint8_t* signature =
+        record_get(installed, RECORD_IMAGE_SIGNATURE, &length);
+    if (flags & RECORD_FLAG_BUILT_IN)
+        valid = initial_image_matches(size, message_size);
+    else if ((flags & RECORD_FLAG_SIGNED) && signature &&
+             length == SIGNATURE_SIZE)
+        valid = verify_signature(digest, signature);
+
+    if (!valid) {
+        uart_write_str(UART2, "[BOOT] Image verification failed\n");
+        return 0;
+    }
+
+    // Reseal the record with the digest of what is in flash now. It is built
+    // again rather than copied, records sealed before RECORD_SEQUENCE have no
+    // room for it.
+    seal_record(build_record(record_number(installed, RECORD_VERSION), size,
+                             message_size, flags,
+                             (flags & RECORD_FLAG_SIGNED) ? signature : NULL,
+                             record_number(installed, RECORD_INSTALL_COUNT)));
+    return 1;
+}
+
+// compare the installed image with the firmware embedded in the bootloader
+int initial_image_matches(uint32_t size, uint32_t message_size) {
+    uint32_t initial_size = (uint32_t)(uintptr_t)&_binary_firmware_bin_size;
+    if (size != initial_size || message_size + 1 != sizeof(initial_msg))
+        return 0;
+
+    return memcmp(HAL_FLASH(FW_BASE), &_binary_firmware_bin_start, size) == 0 &&
+           memcmp(HAL_FLASH(FW_BASE + size), initial_msg,
+                  sizeof(initial_msg)) == 0;
+}
+
+// print how many pages the last install erased, programmed and skipped
+void report_flash_stats(void) {
+    flash_stats stats;
+    flash_get_stats(&stats);
+
+    char buffer[11];
+    uart_write_str(UART2, "[FIRMWARE] Pages erased: ");
+    itoa(stats.erased, buffer, 10);
+    uart_write_str(UART2, buffer);
+    uart_write_str(UART2, ", programmed: ");
+    itoa(stats.programmed, buffer, 10);
+    uart_write_str(UART2, buffer);
+    uart_write_str(UART2, ", skipped: ");
+    itoa(stats.skipped, buffer, 10);
+    uart_write_str(UART2, buffer);
+    nl(UART2);
 }
 
 void load_initial_firmware(void) {
-    if (*((uint32_t*)(METADATA_BASE)) != 0xFFFFFFFF) {
+    // A missing or damaged record means nothing usable is installed
+    if (installed_record())
         return;
-    }
 
     // Create buffers for saving the release message
     uint8_t temp_buf[FLASH_PAGESIZE];
-    // sus release message
-    char initial_msg[] = "This is the initial release message.";
-    uint16_t msg_len = strlen(initial_msg) + 1;
+    uint16_t msg_len = sizeof(initial_msg);
     uint16_t rem_msg_bytes;
 
     // Get included initial firmware
-    int size = (int)&_binary_firmware_bin_size;
+    int size = (int)(uintptr_t)&_binary_firmware_bin_size;
     uint8_t* initial_data = (uint8_t*)&_binary_firmware_bin_start;
 
-    // Set version 2 and install
-    uint16_t version = 2;
-    uint32_t metadata = (((uint16_t)size & 0xFFFF) << 16) | (version & 0xFFFF);
-    program_flash(METADATA_BASE, (uint8_t*)(&metadata), 4);
-
     int i;
     for (i = 0; i < size / FLASH_PAGESIZE; i++) {
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE),
-                      initial_data + (i * FLASH_PAGESIZE), FLASH_PAGESIZE);
+        flash_write_page(FW_BASE + (i * FLASH_PAGESIZE),
+                         initial_data + (i * FLASH_PAGESIZE), FLASH_PAGESIZE);
     }
 
     uint16_t rem_fw_bytes = size % FLASH_PAGESIZE;
     if (rem_fw_bytes == 0) {
         // No firmware left. Just write the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t*)initial_msg,
-                      msg_len);
+        flash_write_page(FW_BASE + (i * FLASH_PAGESIZE), (uint8_t*)initial_msg,
+                         msg_len);
     } else {
         // Some firmware left. Determine how many bytes of release message can
         // fit
@@ -363,69 +1088,120 @@ void load_initial_firmware(void) {
         // Copy what will fit of the release message
         memcpy(temp_buf + rem_fw_bytes, initial_msg, msg_len - rem_msg_bytes);
         // Program the final firmware and first part of the release message
-        program_flash(FW_BASE + (i * FLASH_PAGESIZE), temp_buf,
-                      rem_fw_bytes + (msg_len - rem_msg_bytes));
+        flash_write_page(FW_BASE + (i * FLASH_PAGESIZE), temp_buf,
+                         rem_fw_bytes + (msg_len - rem_msg_bytes));
 
         // If there are more bytes, program them directly from the release
         // message string
         if (rem_msg_bytes > 0) {
             // Writing to a new page. Increment pointer
             i++;
-            program_flash(FW_BASE + (i * FLASH_PAGESIZE),
-                          (uint8_t*)(initial_msg + (msg_len - rem_msg_bytes)),
-                          rem_msg_bytes);
+            flash_write_page(FW_BASE + (i * FLASH_PAGESIZE),
+                             (uint8_t*)(initial_msg + (msg_len - rem_msg_bytes)),
+                             rem_msg_bytes);
         }
     }
+
+    // Set version 2 and seal its record last, so an interrupted install
+    // starts over on the next reset
+    seal_record(build_record(2, size, msg_len - 1, RECORD_FLAG_BUILT_IN, NULL,
+                             1));
 }
 
-long program_flash(uint32_t page_addr, unsigned char* data,
-                   unsigned int data_len) {
-    uint32_t word = 0;
-    int ret;
-    int i;
+// read the start of a protocol step, at most HOST_TIMEOUT ms after since. A
+// dead host aborts the update, which resets the device back to waiting for
+// the next command; the journal keeps the progress made so far.
+void host_read(uint8_t* dst, size_t n, uint32_t since, const char* state) {
+    uint32_t elapsed = systick_ms() - since;
+    if (elapsed >= HOST_TIMEOUT ||
+        uart_read_bulk(dst, n, HOST_TIMEOUT - elapsed) != n) {
+        uart_write_str(UART2, "[TIMEOUT] Host went quiet in ");
+        uart_write_str(UART2, (char*)state);
+        nl(UART2);
+        reject();
+    }
+}
 
-    // Erase next FLASH page
-    FlashErase(page_addr);
-
-    // Clear potentially unused bytes in last word
-    // If data not a multiple of 4 (word size), program up to the last word
-    // Then create temporary variable to create a full last word
-    if (data_len % FLASH_WRITESIZE) {
-        // Get number of unused bytes
-        int rem = data_len % FLASH_WRITESIZE;
-        int num_full_bytes = data_len - rem;
-
-        // Program up to the last word
-        ret = FlashProgram((unsigned long*)data, page_addr, num_full_bytes);
-        if (ret != 0) {
-            return ret;
-        }
+// switch UART1 to a rate proposed by the host. The host has to confirm the
+// new rate, otherwise both sides fall back to the default rate.
+void negotiate_baud(void) {
+    uint32_t baud;
+    if (uart_read_bulk((uint8_t*)&baud, sizeof(baud), READ_TIMEOUT) !=
+        sizeof(baud))
+        return;
 
-        // Create last word variable -- fill unused with 0xFF
-        for (i = 0; i < rem; i++) {
-            word = (word >> 8) |
-                   (data[num_full_bytes + i]
-                    << 24); // Essentially a shift register from MSB->LSB
-        }
-        for (i = i; i < 4; i++) {
-            word = (word >> 8) | 0xFF000000;
+    // The UART needs 16 clocks per bit, a rate of 0 declines the switch
+    if (baud < UART_DEFAULT_BAUD || baud > hal_clock_hz() / 16)
+        baud = 0;
+
+    uart_write(UART1, OK);
+    uart_write_bulk(UART1, (uint8_t*)&baud, sizeof(baud));
+    if (!baud) {
+        uart_write_str(UART2, "[BAUD] Rate not supported\n");
+        return;
+    }
+
+    uart_set_baud(baud);
+    uart_rx_flush();
+
+    // Anything but SYNC is noise from before the host switched
+    uint32_t start = systick_ms();
+    uint32_t elapsed;
+    uint8_t sync;
+    while ((elapsed = systick_ms() - start) < BAUD_CONFIRM_TIMEOUT) {
+        if (uart_read_bulk(&sync, 1, BAUD_CONFIRM_TIMEOUT - elapsed) == 1 &&
+            sync == SYNC) {
+            uart_write(UART1, OK);
+
+            char buffer[11];
+            uart_write_str(UART2, "[BAUD] Switched to ");
+            itoa(baud, buffer, 10);
+            uart_write_str(UART2, buffer);
+            nl(UART2);
+            return;
         }
+    }
 
-        // Program word
-        return FlashProgram(&word, page_addr + num_full_bytes, 4);
-    } else {
-        // Write full buffer of 4-byte words
-        return FlashProgram((unsigned long*)data, page_addr, data_len);
+    uart_write_str(UART2, "[BAUD] Not confirmed, using default rate\n");
+    uart_set_baud(UART_DEFAULT_BAUD);
+    uart_rx_flush();
+}
+
+// check that the image starts with a vector table the core can start from,
+// an image linked without one would be jumped into at its first instruction
+int vector_table_valid(uint32_t size) {
+    const uint32_t* vectors = HAL_FLASH(FW_BASE);
+    uint32_t stack = vectors[0];
+    uint32_t reset = vectors[1];
+
+    // The reset handler is Thumb code inside the image, past the table
+    if (size < 2 * sizeof(uint32_t) || stack <= SRAM_START ||
+        stack > SRAM_END || stack % 4 || !(reset & 1) ||
+        reset < FW_BASE + 2 * sizeof(uint32_t) || reset >= FW_BASE + size) {
+        uart_write_str(UART2, "[BOOT] Firmware has no vector table\n");
+        return 0;
     }
+    return 1;
 }
 
 void boot_firmware(void) {
-    // compute the release message address, and then print it
-    uint16_t fw_size = *fw_size_address;
-    fw_release_message_address = (uint8_t*)(FW_BASE + fw_size);
-    uart_write_str(UART2, (char*)fw_release_message_address);
+    if (!check_boot_record())
+        return;
+    if (!vector_table_valid(
+            record_number(installed_record(), RECORD_IMAGE_SIZE)))
+        return;
+
+    // The record says where the release message is, print it
+    uart_write_str(UART2, HAL_FLASH(record_number(installed_record(),
+                                                  RECORD_MESSAGE_ADDRESS)));
+
+    // Send the last trace records before the firmware takes over UART2
+    TRACE_FLUSH();
+
+    // The firmware expects UART1 at the rate uart_init() sets up
+    if (uart_get_baud() != UART_DEFAULT_BAUD)
+        uart_set_baud(UART_DEFAULT_BAUD);
 
     // Boot the firmware
-    __asm("LDR R0,=0x10001\n\t"
-          "BX R0\n\t");
+    hal_boot(FW_BASE);
 }
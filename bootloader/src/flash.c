@@ -0,0 +1,91 @@
+#include "flash.h"
+
+#include <string.h>
+
+#include "hal.h"
+#include "profile.h"
+
+static flash_stats stats;
+
+// The word the page should hold at offset, bytes past the data stay erased
+static uint32_t target_word(const unsigned char* data, unsigned int data_len,
+                            unsigned int offset) {
+    uint32_t word = 0xFFFFFFFF;
+    if (offset < data_len) {
+        unsigned int n = data_len - offset;
+        if (n > FLASH_WRITESIZE) {
+            n = FLASH_WRITESIZE;
+        }
+        memcpy(&word, data + offset, n);
+    }
+    return word;
+}
+
+static long write_page(uint32_t page_addr, unsigned char* data,
+                       unsigned int data_len) {
+    const volatile uint32_t* page = HAL_FLASH(page_addr);
+    unsigned int offset;
+    int differs = 0;
+    int erase = 0;
+
+    if (data_len > FLASH_PAGESIZE) {
+        return -1;
+    }
+
+    // Programming can only clear bits, anything else needs an erase first
+    for (offset = 0; offset < FLASH_PAGESIZE; offset += FLASH_WRITESIZE) {
+        uint32_t have = page[offset / FLASH_WRITESIZE];
+        uint32_t want = target_word(data, data_len, offset);
+        if (have != want) {
+            differs = 1;
+            if ((have & want) != want) {
+                erase = 1;
+                break;
+            }
+        }
+    }
+
+    if (!differs) {
+        stats.skipped++;
+        return 0;
+    }
+
+    if (erase) {
+        if (hal_flash_erase(page_addr)) {
+            return -1;
+        }
+        stats.erased++;
+    } else {
+        stats.programmed++;
+    }
+
+    // Words past the data are erased already, either way
+    for (offset = 0; offset < data_len; offset += FLASH_WRITESIZE) {
+        uint32_t want = target_word(data, data_len, offset);
+        if (page[offset / FLASH_WRITESIZE] == want) {
+            continue;
+        }
+
+        if (hal_flash_program(&want, page_addr + offset, FLASH_WRITESIZE)) {
+            return -1;
+        }
+
+        if (page[offset / FLASH_WRITESIZE] != want) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+long flash_write_page(uint32_t page_addr, unsigned char* data,
+                      unsigned int data_len) {
+    PROFILE_START(PROFILE_FLASH);
+    long status = write_page(page_addr, data, data_len);
+    PROFILE_STOP(PROFILE_FLASH);
+    return status;
+}
+
+void flash_reset_stats(void) { memset(&stats, 0, sizeof(stats)); }
+
+void flash_get_stats(flash_stats* out) { *out = stats; }
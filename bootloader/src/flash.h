@@ -0,0 +1,59 @@
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <stdint.h>
+
+// FLASH Constants
+#define FLASH_PAGESIZE 1024
+#define FLASH_WRITESIZE 4
+
+/*
+ * Pages handled by flash_write_page since the last flash_reset_stats.
+ * Every page is counted once: erased pages were erased and reprogrammed,
+ * programmed pages only needed bits cleared, skipped pages already matched.
+ */
+typedef struct _flash_stats {
+    uint32_t erased;
+    uint32_t programmed;
+    uint32_t skipped;
+} flash_stats;
+
+/*
+ * Flash Write Page
+ * Makes a flash page hold data followed by erased (0xFF) bytes. The page is
+ * left alone if it already does, and only erased when some bit has to go
+ * from 0 to 1. Only the words that change are programmed, and each one is
+ * read back as it is written.
+ *
+ * Parameters:
+ * page_addr - address of the page, must be page aligned
+ * data - new contents of the page
+ * data_len - bytes of data, at most FLASH_PAGESIZE
+ *
+ * Returns:
+ * 0 on success, nonzero if the flash could not be written
+ */
+long flash_write_page(uint32_t page_addr, unsigned char* data,
+                      unsigned int data_len);
+
+/*
+ * Flash Reset Stats
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void flash_reset_stats(void);
+
+/*
+ * Flash Get Stats
+ * Parameters:
+ * stats - filled with the counts since the last flash_reset_stats
+ *
+ * Returns:
+ * None
+ */
+void flash_get_stats(flash_stats* stats);
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+
+/*
+ * Hardware abstraction for everything the bootloader touches outside of RAM:
+ * flash, interrupts, the reset and the jump into the firmware. The UARTs keep
+ * the uart_* API of uart.h and utility.h, which each backend implements.
+ *
+ * hal_lm3s.c drives the LM3S6965. hal_host.c, built with HAL_HOST by
+ * "make native", runs the bootloader as a Linux process: flash is a file
+ * mapped into memory and the UARTs are file descriptors, see hal_host.c.
+ *
+ * Flash is always named by its address on the board. HAL_FLASH turns an
+ * address into a pointer the bootloader can read the flash contents through.
+ */
+
+#ifdef HAL_HOST
+
+// Whole flash of the LM3S6965, the size of the flash file
+#define HAL_FLASH_SIZE 0x40000
+
+extern uint8_t* hal_flash_base;
+#define HAL_FLASH(addr) ((void*)(hal_flash_base + (uint32_t)(addr)))
+
+// Waits up to a millisecond for input instead of an interrupt
+#define CPU_IDLE_WHILE(cond)                                                   \
+    do {                                                                       \
+        if (cond)                                                              \
+            hal_idle();                                                        \
+    } while (0)
+void hal_idle(void);
+
+// newlib extra the bootloader prints numbers with, glibc has none
+char* itoa(int value, char* str, int base);
+
+#else
+
+#define HAL_FLASH(addr) ((void*)(uint32_t)(addr))
+
+// Sleeps until the next interrupt if cond still holds. cond is checked with
+// interrupts masked: an interrupt that arrives after the check stays pending
+// and wakes WFI at once, so the wakeup it brings is never lost. It runs once
+// the mask is restored. The UART1 receive interrupt and SysTick both wake the
+// core, so a reader looks at its timeout at least once a SysTick period: 1 ms
+// normally, 2^24 cycles in PROFILE_SYSTICK builds.
+#define CPU_IDLE_WHILE(cond)                                                   \
+    do {                                                                       \
+        uint32_t primask;                                                      \
+        __asm volatile("mrs %0, primask\n"                                     \
+                       "cpsid i" : "=r"(primask)::"memory");                   \
+        if (cond)                                                              \
+            __asm volatile("wfi" ::: "memory");                                \
+        __asm volatile("msr primask, %0" ::"r"(primask) : "memory");           \
+    } while (0)
+
+#endif
+
+/*
+ * HAL Init
+ * Brings up what has to work before anything else: on the board the UART0
+ * reset interrupt, on the host the flash file. uart_init(UART0) must be
+ * called first.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void hal_init(void);
+
+/*
+ * HAL Flash Erase
+ * Parameters:
+ * addr - address of the page, must be page aligned
+ *
+ * Returns:
+ * 0 on success, nonzero if the page could not be erased
+ */
+long hal_flash_erase(uint32_t addr);
+
+/*
+ * HAL Flash Program
+ * Programs words of flash. Like the hardware, programming can only clear
+ * bits, so the words should be erased first.
+ *
+ * Parameters:
+ * data - words to program
+ * addr - address of the first word, must be word aligned
+ * len - bytes to program, a multiple of 4
+ *
+ * Returns:
+ * 0 on success, nonzero if the flash could not be programmed
+ */
+long hal_flash_program(const void* data, uint32_t addr, uint32_t len);
+
+/*
+ * HAL IRQ Disable
+ * Masks interrupts, which also keeps UART0 from resetting the device
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void hal_irq_disable(void);
+
+/*
+ * HAL IRQ Enable
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void hal_irq_enable(void);
+
+/*
+ * HAL Clock
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * system clock in Hz
+ */
+uint32_t hal_clock_hz(void);
+
+/*
+ * HAL UART TX Empty
+ * Parameters:
+ * uart - uart port
+ *
+ * Returns:
+ * nonzero if nothing is waiting to be sent on the port
+ */
+int hal_uart_tx_empty(uint8_t uart);
+
+/*
+ * HAL Reset
+ * Resets the device, the bootloader starts over
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * Does not return
+ */
+void hal_reset(void) __attribute__((noreturn));
+
+/*
+ * HAL Boot
+ * Starts the firmware the way a reset would: the bootloader's interrupts are
+ * turned off, VTOR is pointed at the firmware's vector table and the stack
+ * pointer and reset handler are taken from it. On the host, which cannot run
+ * the firmware, the process reports the jump and exits.
+ *
+ * Parameters:
+ * addr - address of the firmware, which starts with its vector table
+ *
+ * Returns:
+ * Does not return
+ */
+void hal_boot(uint32_t addr) __attribute__((noreturn));
+
+#endif
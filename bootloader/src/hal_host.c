@@ -0,0 +1,282 @@
+// clock_gettime, ftruncate and the rest of POSIX
+#define _POSIX_C_SOURCE 200809L
+
+#include "hal.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "flash.h"
+#include "trace.h"
+#include "utility.h"
+
+/*
+ * Host backend, built by "make native". The board becomes:
+ *  - flash: the file named by OBSIDIAN_FLASH (flash.bin by default), mapped
+ *    into memory, so it keeps its contents across runs and resets. A new
+ *    file starts out erased.
+ *  - UART1: stdin and stdout
+ *  - UART2: stderr
+ *  - UART0: descriptor 3 if it is open. A space read from it resets, like
+ *    the UART0 interrupt handler on the board.
+ * Like a serial line, a UART nobody listens to any more drops what is sent.
+ *  - SysTick: the monotonic clock
+ * A reset executes the binary again, keeping the descriptors and the flash
+ * file. tools/bl_native.py serves the UARTs on the emulator's sockets.
+ */
+
+#define FLASH_ENV "OBSIDIAN_FLASH"
+#define FLASH_DEFAULT "flash.bin"
+#define UART0_FD 3
+#define RESET_CHAR ' '
+
+// The LM3S6965 clock, so rate negotiation accepts the same rates
+#define CLOCK_HZ 50000000
+
+uint8_t* hal_flash_base;
+
+static int irq_enabled = 0;
+static int uart0_open = 0;
+static struct timespec start_time;
+static uint32_t uart1_baud = UART_DEFAULT_BAUD;
+
+static void __attribute__((noreturn)) fail(const char* what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+void hal_init(void) {
+    const char* path = getenv(FLASH_ENV);
+    if (!path) {
+        path = FLASH_DEFAULT;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)) {
+        fail(path);
+    }
+    if (st.st_size < HAL_FLASH_SIZE && ftruncate(fd, HAL_FLASH_SIZE)) {
+        fail(path);
+    }
+
+    hal_flash_base = mmap(NULL, HAL_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+    if (hal_flash_base == MAP_FAILED) {
+        fail(path);
+    }
+    close(fd);
+
+    // Grown files read as zeros, erase what the file did not hold yet
+    if (st.st_size < HAL_FLASH_SIZE) {
+        memset(hal_flash_base + st.st_size, 0xFF,
+               HAL_FLASH_SIZE - st.st_size);
+    }
+
+    uart0_open = fcntl(UART0_FD, F_GETFD) != -1;
+    signal(SIGPIPE, SIG_IGN);
+    irq_enabled = 1;
+}
+
+// Only flash the board has can be erased or programmed
+static int flash_range_valid(uint32_t addr, uint32_t len) {
+    return addr <= HAL_FLASH_SIZE && len <= HAL_FLASH_SIZE - addr;
+}
+
+long hal_flash_erase(uint32_t addr) {
+    if (addr % FLASH_PAGESIZE || !flash_range_valid(addr, FLASH_PAGESIZE)) {
+        return -1;
+    }
+    memset(hal_flash_base + addr, 0xFF, FLASH_PAGESIZE);
+    return 0;
+}
+
+long hal_flash_program(const void* data, uint32_t addr, uint32_t len) {
+    if (addr % FLASH_WRITESIZE || len % FLASH_WRITESIZE ||
+        !flash_range_valid(addr, len)) {
+        return -1;
+    }
+
+    // Programming can only clear bits, like on the board
+    const uint8_t* src = data;
+    for (uint32_t i = 0; i < len; i++) {
+        hal_flash_base[addr + i] &= src[i];
+    }
+    return 0;
+}
+
+void hal_irq_disable(void) { irq_enabled = 0; }
+
+void hal_irq_enable(void) { irq_enabled = 1; }
+
+uint32_t hal_clock_hz(void) { return CLOCK_HZ; }
+
+int hal_uart_tx_empty(uint8_t uart) {
+    // Writes go straight to the descriptor
+    return 1;
+}
+
+void hal_reset(void) {
+    msync(hal_flash_base, HAL_FLASH_SIZE, MS_SYNC);
+
+    char* const argv[] = {"bootloader", NULL};
+    execv("/proc/self/exe", argv);
+    fail("reset");
+}
+
+void hal_boot(uint32_t addr) {
+    msync(hal_flash_base, HAL_FLASH_SIZE, MS_SYNC);
+
+    // The firmware is Cortex-M3 code, the host stops where the board jumps
+    char buffer[11];
+    uart_write_str(UART2, "[HAL] Jumping to firmware at 0x");
+    uart_write_str(UART2, itoa(addr, buffer, 16));
+    nl(UART2);
+    exit(EXIT_SUCCESS);
+}
+
+void hal_idle(void) {
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {UART0_FD, POLLIN, 0}};
+    poll(fds, uart0_open ? 2 : 1, 1);
+
+    uint8_t c;
+    if (uart0_open && irq_enabled && (fds[1].revents & (POLLIN | POLLHUP))) {
+        if (read(UART0_FD, &c, 1) != 1) {
+            uart0_open = 0;
+        } else if (c == RESET_CHAR) {
+            hal_reset();
+        }
+    }
+
+    // What SysTick_Handler does on the board
+    TRACE_POLL();
+}
+
+char* itoa(int value, char* str, int base) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    char* p = str;
+    unsigned int v = value;
+    if (value < 0 && base == 10) {
+        *p++ = '-';
+        v = -(unsigned int)value;
+    }
+
+    char reversed[33];
+    int n = 0;
+    do {
+        reversed[n++] = digits[v % base];
+        v /= base;
+    } while (v);
+    while (n) {
+        *p++ = reversed[--n];
+    }
+    *p = '\0';
+    return str;
+}
+
+// uart.h
+
+static void write_all(int fd, const void* src, size_t n) {
+    const uint8_t* p = src;
+    while (n) {
+        ssize_t written = write(fd, p, n);
+        if (written <= 0) {
+            return;
+        }
+        p += written;
+        n -= written;
+    }
+}
+
+static int uart_out(uint8_t uart) {
+    return uart == UART1 ? STDOUT_FILENO : uart == UART2 ? STDERR_FILENO : -1;
+}
+
+void uart_init(uint8_t uart) {}
+
+void uart_write(uint8_t uart, uint32_t data) {
+    uint8_t byte = data;
+    uart_write_bulk(uart, &byte, 1);
+}
+
+void uart_write_str(uint8_t uart, char* str) {
+    uart_write_bulk(uart, (const uint8_t*)str, strlen(str));
+}
+
+void nl(uint8_t uart) { uart_write(uart, '\n'); }
+
+// utility.h
+
+void systick_init(void) { clock_gettime(CLOCK_MONOTONIC, &start_time); }
+
+uint32_t systick_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) * 1000 +
+           (now.tv_nsec - start_time.tv_nsec) / 1000000;
+}
+
+void uart_rx_init(void) {}
+
+// Reads what is there without waiting, the host hanging up ends the run
+static size_t read_available(uint8_t* dst, size_t n) {
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&fd, 1, 0) <= 0 || !(fd.revents & (POLLIN | POLLHUP))) {
+        return 0;
+    }
+
+    ssize_t got = read(STDIN_FILENO, dst, n);
+    if (got <= 0) {
+        uart_write_str(UART2, "[HAL] UART1 closed\n");
+        exit(EXIT_SUCCESS);
+    }
+    return got;
+}
+
+size_t uart_read_bulk(uint8_t* dst, size_t n, uint32_t timeout) {
+    uint32_t start = systick_ms();
+    size_t copied = 0;
+
+    while (copied < n) {
+        size_t got = read_available(dst + copied, n - copied);
+        if (got) {
+            copied += got;
+            continue;
+        }
+
+        if (timeout != UART_WAIT_FOREVER && systick_ms() - start >= timeout) {
+            break;
+        }
+        hal_idle();
+    }
+
+    return copied;
+}
+
+void uart_write_bulk(uint8_t uart, const uint8_t* src, size_t n) {
+    int fd = uart_out(uart);
+    if (fd >= 0) {
+        write_all(fd, src, n);
+    }
+}
+
+void uart_rx_flush(void) {
+    uint8_t drop[256];
+    while (read_available(drop, sizeof(drop))) {
+    }
+}
+
+void uart_set_baud(uint32_t baud) {
+    // A descriptor has no line rate, the rate is only recorded
+    uart1_baud = baud;
+}
+
+uint32_t uart_get_baud(void) { return uart1_baud; }
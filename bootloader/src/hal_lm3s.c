@@ -0,0 +1,246 @@
+#include "hal.h"
+
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_nvic.h"
+#include "inc/hw_types.h"
+#include "inc/hw_uart.h"
+#include "driverlib/flash.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/systick.h"
+#include "driverlib/uart.h"
+
+#include "trace.h"
+#include "utility.h"
+
+void hal_init(void) {
+    // The UART0 interrupt handler resets the device
+    IntEnable(INT_UART0);
+    IntMasterEnable();
+}
+
+long hal_flash_erase(uint32_t addr) { return FlashErase(addr); }
+
+long hal_flash_program(const void* data, uint32_t addr, uint32_t len) {
+    return FlashProgram((unsigned long*)data, addr, len);
+}
+
+void hal_irq_disable(void) { IntMasterDisable(); }
+
+void hal_irq_enable(void) { IntMasterEnable(); }
+
+uint32_t hal_clock_hz(void) { return SysCtlClockGet(); }
+
+int hal_uart_tx_empty(uint8_t uart) {
+    static const uint32_t bases[] = {UART0_BASE, UART1_BASE, UART2_BASE};
+    return (HWREG(bases[uart] + UART_O_FR) & UART_FR_TXFE) != 0;
+}
+
+void hal_reset(void) {
+    SysCtlReset();
+    while (1) {
+    }
+}
+
+void hal_boot(uint32_t addr) {
+    const uint32_t* vectors = HAL_FLASH(addr);
+
+    // The firmware gets the core as a reset leaves it. None of the
+    // bootloader's interrupts may stay enabled or pending, their handlers are
+    // not in the firmware's vector table.
+    IntMasterDisable();
+    SysTickIntDisable();
+    SysTickDisable();
+    UARTIntDisable(UART0_BASE, 0xFFFFFFFF);
+    UARTIntDisable(UART1_BASE, 0xFFFFFFFF);
+    HWREG(NVIC_DIS0) = 0xFFFFFFFF;
+    HWREG(NVIC_DIS1) = 0xFFFFFFFF;
+    HWREG(NVIC_UNPEND0) = 0xFFFFFFFF;
+    HWREG(NVIC_UNPEND1) = 0xFFFFFFFF;
+    HWREG(NVIC_INT_CTRL) = NVIC_INT_CTRL_PENDSTCLR;
+
+    // Exceptions now go to the firmware's table. Like the core coming out of
+    // reset, take the stack pointer and the reset handler from it.
+    HWREG(NVIC_VTABLE) = addr;
+    __asm volatile("MSR msp, %0\n"
+                   "CPSIE i\n"
+                   "BX %1\n" ::"r"(vectors[0]),
+                   "r"(vectors[1]));
+    __builtin_unreachable();
+}
+
+// UART1 receive ring, filled by UART1_IRQHandler and drained by
+// uart_read_bulk. The ISR only ever moves rx_head and the reader only ever
+// moves rx_tail, so no locking is needed.
+static uint8_t rx_ring[UART_RX_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+static const uint32_t uart_bases[] = {UART0_BASE, UART1_BASE, UART2_BASE};
+
+// Current UART1 rate, changed by uart_set_baud
+static uint32_t uart1_baud = UART_DEFAULT_BAUD;
+
+#ifdef PROFILE_SYSTICK
+
+// QEMU has no cycle counter, so profiled builds for it count cycles with
+// SysTick, which -icount advances with the instructions executed. SysTick
+// runs its longest period, which keeps the count right through code that
+// masks interrupts for several milliseconds, and milliseconds are derived
+// from the count. Readers only look at their timeouts when an interrupt
+// wakes the core, so a timeout can expire up to a period late.
+#define SYSTICK_PERIOD 0x1000000
+
+// Periods since systick_init, advanced by SysTick_Handler
+static volatile uint32_t systick_wraps = 0;
+static uint32_t cycles_per_ms;
+
+void systick_init(void) {
+    cycles_per_ms = SysCtlClockGet() / 1000;
+    SysTickPeriodSet(SYSTICK_PERIOD);
+    SysTickIntEnable();
+    SysTickEnable();
+}
+
+static uint64_t systick_total(void) {
+    uint32_t wraps;
+    uint32_t before;
+    uint32_t value;
+    uint32_t pending;
+
+    // Sample again if the counter reloaded or the interrupt ran meanwhile.
+    // A reload that is pending, or masked, has not been counted yet.
+    do {
+        wraps = systick_wraps;
+        before = SysTickValueGet();
+        pending = HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_PENDSTSET;
+        value = SysTickValueGet();
+    } while (wraps != systick_wraps || value > before);
+
+    if (pending) {
+        wraps++;
+    }
+    return (uint64_t)wraps * SYSTICK_PERIOD + (SYSTICK_PERIOD - 1 - value);
+}
+
+uint32_t systick_cycles(void) { return systick_total(); }
+
+uint32_t systick_ms(void) { return systick_total() / cycles_per_ms; }
+
+void SysTick_Handler(void) {
+    systick_wraps++;
+
+    // Only does something in TRACE builds
+    TRACE_POLL();
+}
+
+#else
+
+// Milliseconds since systick_init, advanced by SysTick_Handler
+static volatile uint32_t systick_count = 0;
+
+void systick_init(void) {
+    SysTickPeriodSet(SysCtlClockGet() / 1000);
+    SysTickIntEnable();
+    SysTickEnable();
+}
+
+uint32_t systick_ms(void) { return systick_count; }
+
+void SysTick_Handler(void) {
+    systick_count++;
+
+    // Only does something in TRACE builds
+    TRACE_POLL();
+}
+
+#endif
+
+void uart_rx_init(void) {
+    // Interrupt when the FIFO is half full or the line goes idle
+    UARTFIFOLevelSet(UART1_BASE, UART_FIFO_TX4_8, UART_FIFO_RX4_8);
+    UARTIntEnable(UART1_BASE, UART_INT_RX | UART_INT_RT);
+    IntEnable(INT_UART1);
+}
+
+void UART1_IRQHandler(void) {
+    UARTIntClear(UART1_BASE, UARTIntStatus(UART1_BASE, true));
+
+    // Drain the hardware FIFO, dropping bytes if the ring is full
+    uint32_t head = rx_head;
+    while (UARTCharsAvail(UART1_BASE)) {
+        uint8_t data = UARTCharGetNonBlocking(UART1_BASE);
+        if (head - rx_tail < UART_RX_RING_SIZE) {
+            rx_ring[head & (UART_RX_RING_SIZE - 1)] = data;
+            head++;
+        }
+    }
+
+    // Publish the bytes only after they are in the ring
+    COMPILER_BARRIER();
+    rx_head = head;
+}
+
+size_t uart_read_bulk(uint8_t* dst, size_t n, uint32_t timeout) {
+    uint32_t start = systick_ms();
+    size_t copied = 0;
+
+    while (copied < n) {
+        uint32_t tail = rx_tail;
+        uint32_t available = rx_head - tail;
+
+        if (!available) {
+            if (timeout != UART_WAIT_FOREVER && systick_ms() - start >= timeout)
+                break;
+            CPU_IDLE_WHILE(rx_head == tail);
+            continue;
+        }
+        COMPILER_BARRIER();
+
+        // Copy the longest run that doesn't wrap around the end of the ring
+        uint32_t offset = tail & (UART_RX_RING_SIZE - 1);
+        size_t run = UART_RX_RING_SIZE - offset;
+        if (run > available)
+            run = available;
+        if (run > n - copied)
+            run = n - copied;
+
+        memcpy(dst + copied, rx_ring + offset, run);
+        copied += run;
+
+        COMPILER_BARRIER();
+        rx_tail = tail + run;
+    }
+
+    return copied;
+}
+
+void uart_write_bulk(uint8_t uart, const uint8_t* src, size_t n) {
+    uint32_t base = uart_bases[uart];
+
+    // Keep the TX FIFO topped up until everything has been queued
+    for (size_t i = 0; i < n;) {
+        while (i < n && UARTSpaceAvail(base)) {
+            UARTCharPutNonBlocking(base, src[i++]);
+        }
+    }
+}
+
+void uart_rx_flush(void) {
+    // Only the reader moves rx_tail, so catching it up to rx_head is safe
+    rx_tail = rx_head;
+}
+
+void uart_set_baud(uint32_t baud) {
+    // Let the last reply leave at the old rate
+    while (UARTBusy(UART1_BASE)) {
+    }
+
+    UARTConfigSetExpClk(UART1_BASE, SysCtlClockGet(), baud,
+                        UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
+                            UART_CONFIG_PAR_NONE);
+    uart1_baud = baud;
+}
+
+uint32_t uart_get_baud(void) { return uart1_baud; }
@@ -0,0 +1,158 @@
+#include "journal.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "hal.h"
+#include "record.h"
+
+#define JOURNAL_ERASED 0xFFFFFFFF
+
+// Page entries are being appended to, 0 when there is no journal
+static uint32_t active;
+static uint32_t next_entry;
+static journal_header header;
+
+static uint32_t page_address(int page) {
+    return JOURNAL_BASE + page * JOURNAL_PAGE_SIZE;
+}
+
+static const journal_header* page_header(int page) {
+    return HAL_FLASH(page_address(page));
+}
+
+static int header_valid(const journal_header* h) {
+    return h->magic == JOURNAL_MAGIC &&
+           record_crc32((const uint8_t*)h, offsetof(journal_header, crc)) ==
+               h->crc;
+}
+
+static int entry_valid(const journal_entry* e) {
+    return record_crc32((const uint8_t*)e, offsetof(journal_entry, crc)) ==
+           e->crc;
+}
+
+// Program erased flash and read it back, len is a multiple of 4
+static long program(uint32_t addr, const void* data, uint32_t len) {
+    if (hal_flash_program(data, addr, len)) {
+        return -1;
+    }
+    return memcmp(HAL_FLASH(addr), data, len) != 0;
+}
+
+// Erase a page and make it the active one
+static long open_page(uint32_t addr, uint32_t sequence) {
+    if (hal_flash_erase(addr)) {
+        return -1;
+    }
+
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = sequence;
+    header.crc =
+        record_crc32((const uint8_t*)&header, offsetof(journal_header, crc));
+    if (program(addr, &header, sizeof(header))) {
+        return -1;
+    }
+
+    active = addr;
+    next_entry = 0;
+    return 0;
+}
+
+// Finds the last valid entry of a page and the first slot that was never
+// written. An entry cut off while it was written is skipped; words are
+// programmed in order, so an erased first word means the slot is unused.
+static const journal_entry* last_entry(const journal_header* h,
+                                       uint32_t* free_slot) {
+    const journal_entry* entries = (const journal_entry*)(h + 1);
+    const journal_entry* last = 0;
+    uint32_t n;
+    for (n = 0; n < JOURNAL_ENTRIES; n++) {
+        if (entries[n].staged_len == JOURNAL_ERASED) {
+            break;
+        }
+        if (entry_valid(&entries[n])) {
+            last = &entries[n];
+        }
+    }
+    *free_slot = n;
+    return last;
+}
+
+int journal_resume(const uint8_t* identity, uint32_t* staged_len,
+                   uint8_t* link) {
+    // Newest page first. The older one still counts if the journal moved
+    // on but was cut off before the new page got its first entry.
+    int pages[JOURNAL_PAGES] = {0, 1};
+    if (page_header(1)->sequence > page_header(0)->sequence) {
+        pages[0] = 1;
+        pages[1] = 0;
+    }
+
+    for (int i = 0; i < JOURNAL_PAGES; i++) {
+        const journal_header* h = page_header(pages[i]);
+        if (!header_valid(h) ||
+            memcmp(h->identity, identity, JOURNAL_ID_SIZE) != 0) {
+            continue;
+        }
+
+        uint32_t free_slot;
+        const journal_entry* last = last_entry(h, &free_slot);
+        if (!last) {
+            continue;
+        }
+
+        active = page_address(pages[i]);
+        next_entry = free_slot;
+        header = *h;
+
+        *staged_len = last->staged_len;
+        memcpy(link, last->link, JOURNAL_LINK_SIZE);
+        return 1;
+    }
+    return 0;
+}
+
+long journal_start(const uint8_t* identity) {
+    active = 0;
+    if (hal_flash_erase(page_address(1))) {
+        return -1;
+    }
+
+    memcpy(header.identity, identity, JOURNAL_ID_SIZE);
+    return open_page(JOURNAL_BASE, 0);
+}
+
+long journal_commit(uint32_t staged_len, const uint8_t* link) {
+    if (!active) {
+        return -1;
+    }
+
+    // A full page moves the journal to the other one
+    if (next_entry == JOURNAL_ENTRIES) {
+        uint32_t other = active == JOURNAL_BASE
+                             ? JOURNAL_BASE + JOURNAL_PAGE_SIZE
+                             : JOURNAL_BASE;
+        if (open_page(other, header.sequence + 1)) {
+            return -1;
+        }
+    }
+
+    journal_entry entry;
+    entry.staged_len = staged_len;
+    memcpy(entry.link, link, JOURNAL_LINK_SIZE);
+    entry.crc =
+        record_crc32((const uint8_t*)&entry, offsetof(journal_entry, crc));
+
+    uint32_t addr = active + sizeof(journal_header) +
+                    next_entry * sizeof(journal_entry);
+    next_entry++;
+    return program(addr, &entry, sizeof(entry));
+}
+
+void journal_clear(void) {
+    active = 0;
+    for (int page = 0; page < JOURNAL_PAGES; page++) {
+        hal_flash_erase(page_address(page));
+    }
+}
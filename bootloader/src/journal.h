@@ -0,0 +1,97 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+/*
+ * Progress journal of an update, so a transfer cut off by a reset or a
+ * dropped link can continue where it stopped. It lives in two flash pages
+ * below the device record. The active page starts with a journal_header
+ * naming the image, followed by one journal_entry for every page staged.
+ * Entries are only ever appended to erased flash; when a page is full the
+ * journal moves to the other page with a higher sequence number, so there
+ * is always a complete copy of the latest entry.
+ */
+
+#define JOURNAL_BASE 0xF000 // the bootloader has to end below this
+#define JOURNAL_PAGE_SIZE 1024
+#define JOURNAL_PAGES 2
+
+#define JOURNAL_MAGIC 0x4C4E524A // "JRNL"
+#define JOURNAL_ID_SIZE 32
+#define JOURNAL_LINK_SIZE 32
+
+// Start of a journal page, identity is the digest of the signed headers of
+// the update
+typedef struct _journal_header {
+    uint32_t magic;
+    uint32_t sequence;
+    uint8_t identity[JOURNAL_ID_SIZE];
+    uint32_t crc;
+} journal_header;
+
+// Bytes staged so far, always whole pages, and the hash chain link the next
+// frame has to match
+typedef struct _journal_entry {
+    uint32_t staged_len;
+    uint8_t link[JOURNAL_LINK_SIZE];
+    uint32_t crc;
+} journal_entry;
+
+#define JOURNAL_ENTRIES                                                        \
+    ((JOURNAL_PAGE_SIZE - sizeof(journal_header)) / sizeof(journal_entry))
+
+/*
+ * Journal Resume
+ * Looks for the progress of an interrupted update of the same image, and
+ * continues its journal if there is one
+ *
+ * Parameters:
+ * identity - digest of the signed headers of the update
+ * staged_len - set to the bytes already staged
+ * link - set to the link the next frame has to match, JOURNAL_LINK_SIZE bytes
+ *
+ * Returns:
+ * 1 if the update can resume, 0 if it has to start over
+ */
+int journal_resume(const uint8_t* identity, uint32_t* staged_len,
+                   uint8_t* link);
+
+/*
+ * Journal Start
+ * Erases the journal and starts a new one for an update
+ *
+ * Parameters:
+ * identity - digest of the signed headers of the update
+ *
+ * Returns:
+ * 0 on success, nonzero if the flash could not be written
+ */
+long journal_start(const uint8_t* identity);
+
+/*
+ * Journal Commit
+ * Records a staged page, after it has been written
+ *
+ * Parameters:
+ * staged_len - bytes staged so far
+ * link - link the next frame has to match
+ *
+ * Returns:
+ * 0 on success, nonzero if the flash could not be written
+ */
+long journal_commit(uint32_t staged_len, const uint8_t* link);
+
+/*
+ * Journal Clear
+ * Erases the journal once the update is installed
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void journal_clear(void);
+
+#endif
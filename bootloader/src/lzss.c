@@ -0,0 +1,96 @@
+#include "lzss.h"
+
+#include "hal.h"
+
+void lzss_init(lzss_decoder* d, uint32_t base, uint32_t limit,
+               unsigned char* page, uint16_t page_size,
+               lzss_write_page write_page) {
+    d->base = base;
+    d->limit = limit;
+    d->out_len = 0;
+    d->page = page;
+    d->page_size = page_size;
+    d->page_fill = 0;
+    d->flags = 0;
+    d->flag_count = 0;
+    d->token_fill = 0;
+    d->write_page = write_page;
+}
+
+// Append a byte of output, committing the page once it is full
+static int lzss_put(lzss_decoder* d, uint8_t byte) {
+    if (d->out_len >= d->limit)
+        return -1;
+
+    d->page[d->page_fill++] = byte;
+    d->out_len++;
+
+    if (d->page_fill == d->page_size) {
+        uint32_t addr = d->base + d->out_len - d->page_size;
+        if (d->write_page(addr, d->page, d->page_size))
+            return -1;
+        d->page_fill = 0;
+    }
+    return 0;
+}
+
+// Byte of output from distance bytes back, from RAM if it is in the current
+// page and from flash if it was already committed
+static uint8_t lzss_history(lzss_decoder* d, uint32_t distance) {
+    if (distance <= d->page_fill)
+        return d->page[d->page_fill - distance];
+    return *(const uint8_t*)HAL_FLASH(d->base + d->out_len - distance);
+}
+
+int lzss_feed(lzss_decoder* d, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        uint8_t byte = in[i];
+
+        // Every group of eight items starts with its flag byte
+        if (!d->flag_count) {
+            d->flags = byte;
+            d->flag_count = 8;
+            continue;
+        }
+
+        if (d->flags & 1) {
+            if (lzss_put(d, byte))
+                return -1;
+        } else {
+            d->token[d->token_fill++] = byte;
+            if (d->token_fill < 2)
+                continue;
+
+            uint32_t distance = (d->token[0] | ((d->token[1] & 0xF0) << 4)) + 1;
+            uint32_t length = (d->token[1] & 0x0F) + LZSS_MIN_MATCH;
+            d->token_fill = 0;
+
+            if (distance > d->out_len)
+                return -1;
+
+            // Matches may overlap their own output, so copy a byte at a time
+            for (uint32_t j = 0; j < length; j++) {
+                if (lzss_put(d, lzss_history(d, distance)))
+                    return -1;
+            }
+        }
+
+        d->flags >>= 1;
+        d->flag_count--;
+    }
+
+    return 0;
+}
+
+int lzss_finish(lzss_decoder* d) {
+    if (d->token_fill || d->out_len != d->limit)
+        return -1;
+
+    if (d->page_fill) {
+        uint32_t addr = d->base + d->out_len - d->page_fill;
+        if (d->write_page(addr, d->page, d->page_fill))
+            return -1;
+        d->page_fill = 0;
+    }
+    return 0;
+}
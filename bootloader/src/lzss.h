@@ -0,0 +1,85 @@
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LZSS stream format
+ * Items come in groups of eight, each group led by a flag byte read from its
+ * least significant bit up. A set bit is a literal byte. A clear bit is a two
+ * byte match:
+ *
+ * [ byte 0 ]           [ byte 1 ]
+ * ---------------------------------------------------
+ * | distance - 1 (low) | distance - 1 (high) | length - 3 |
+ * |      8 bits        |       4 bits        |   4 bits   |
+ * ---------------------------------------------------
+ *
+ * so a match copies 3 to 18 bytes from up to 4096 bytes back.
+ */
+#define LZSS_WINDOW_SIZE 4096
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH 18
+
+/*
+ * Called with every full output page, and with the final partial page.
+ * Returns 0 on success.
+ */
+typedef long (*lzss_write_page)(uint32_t addr, unsigned char* page,
+                                unsigned int len);
+
+/*
+ * The decoder writes its output straight to flash and reads match history
+ * back from there, so it needs no window buffer of its own. Only the page
+ * currently being assembled lives in RAM.
+ */
+typedef struct _lzss_decoder {
+    uint32_t base;        // flash address of the first output byte
+    uint32_t limit;       // expected output length
+    uint32_t out_len;     // bytes produced so far
+    unsigned char* page;  // output page buffer
+    uint16_t page_size;
+    uint16_t page_fill;   // bytes in the output page buffer
+    uint8_t flags;        // flag byte of the current group
+    uint8_t flag_count;   // items left in the current group
+    uint8_t token[2];     // partially received match
+    uint8_t token_fill;
+    lzss_write_page write_page;
+} lzss_decoder;
+
+/*
+ * LZSS Init
+ * Parameters:
+ * d - decoder state
+ * base - flash address to decompress to, must be page aligned
+ * limit - exact number of bytes the stream decompresses to
+ * page - output page buffer of page_size bytes
+ * write_page - commits a page of output to flash
+ *
+ * Returns:
+ * None
+ */
+void lzss_init(lzss_decoder* d, uint32_t base, uint32_t limit,
+               unsigned char* page, uint16_t page_size,
+               lzss_write_page write_page);
+
+/*
+ * LZSS Feed
+ * Decompresses the next n bytes of the stream
+ *
+ * Returns:
+ * 0 on success, -1 if the stream is corrupt or a page failed to write
+ */
+int lzss_feed(lzss_decoder* d, const uint8_t* in, size_t n);
+
+/*
+ * LZSS Finish
+ * Writes the final partial page
+ *
+ * Returns:
+ * 0 if the stream ended cleanly at exactly limit bytes, -1 otherwise
+ */
+int lzss_finish(lzss_decoder* d);
+
+#endif
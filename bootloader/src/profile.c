@@ -0,0 +1,51 @@
+#include "profile.h"
+
+#include <string.h>
+
+#include "utility.h"
+
+// Debug registers that gate the cycle counter
+#define DEMCR (*(volatile uint32_t*)0xE000EDFC)
+#define DEMCR_TRCENA 0x01000000
+#define DWT_CTRL (*(volatile uint32_t*)0xE0001000)
+#define DWT_CTRL_CYCCNTENA 0x00000001
+
+static profile_stats stats[PROFILE_PHASE_COUNT];
+
+void profile_init(void) {
+#ifndef PROFILE_SYSTICK
+    DEMCR |= DEMCR_TRCENA;
+    PROFILE_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+#endif
+
+    profile_reset();
+}
+
+void profile_reset(void) {
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++) {
+        stats[i].min = 0xFFFFFFFF;
+    }
+}
+
+void profile_record(profile_phase phase, uint32_t cycles) {
+    profile_stats* s = &stats[phase];
+
+    s->count++;
+    s->total += cycles;
+    if (cycles < s->min) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+}
+
+void profile_report(uint8_t uart) {
+    uint8_t header[] = {PROFILE_VERSION, PROFILE_PHASE_COUNT};
+
+    uart_write_bulk(uart, (uint8_t*)PROFILE_MAGIC, strlen(PROFILE_MAGIC));
+    uart_write_bulk(uart, header, sizeof(header));
+    uart_write_bulk(uart, (uint8_t*)stats, sizeof(stats));
+}
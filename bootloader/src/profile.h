@@ -0,0 +1,125 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/*
+ * Cycle-count profiling of the update path, built only with "make PROFILE=1".
+ * Without it every macro below expands to nothing and profile.c is not
+ * linked, so a normal build is unchanged.
+ */
+
+// Phases of an update, in the order they are reported
+typedef enum _profile_phase {
+    PROFILE_UPDATE,     // whole update, metadata to ready to boot
+    PROFILE_METADATA,   // load_metadata
+    PROFILE_FRAME,      // one frame, from its header to its acknowledgement
+    PROFILE_SHA256,     // hashing a frame or the installed image
+    PROFILE_VERIFY,     // verify_signature
+    PROFILE_AES,        // AES-CBC decryption of one page
+    PROFILE_DECOMPRESS, // LZSS decoding of one page, with its flash writes
+    PROFILE_FLASH,      // flash_write_page
+    PROFILE_PHASE_COUNT
+} profile_phase;
+
+// The report starts with these bytes, then the version and phase count
+#define PROFILE_MAGIC "PROF"
+#define PROFILE_VERSION 1
+
+/*
+ * Statistics for one phase, sent as is in the report. Totals are 64 bits,
+ * the cycle counter wraps after about 85 seconds at 50 MHz.
+ */
+typedef struct __attribute__((packed)) _profile_stats {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profile_stats;
+
+#ifdef PROFILE
+
+#ifdef PROFILE_SYSTICK
+
+// "make PROFILE=systick" counts with SysTick instead, for QEMU, which has no
+// DWT. Under -icount the counts only depend on the instructions executed.
+#include "utility.h"
+#define PROFILE_CYCLES() systick_cycles()
+
+#else
+
+// DWT cycle counter of the Cortex-M3
+#define PROFILE_CYCCNT (*(volatile uint32_t*)0xE0001004)
+#define PROFILE_CYCLES() PROFILE_CYCCNT
+
+#endif
+
+// Time the code between PROFILE_START and PROFILE_STOP of the same phase.
+// Both must be in the same block.
+#define PROFILE_START(phase) uint32_t profile_start_##phase = PROFILE_CYCLES()
+#define PROFILE_STOP(phase)                                                    \
+    profile_record(phase, PROFILE_CYCLES() - profile_start_##phase)
+
+#define PROFILE_INIT() profile_init()
+#define PROFILE_RESET() profile_reset()
+#define PROFILE_REPORT(uart) profile_report(uart)
+
+/*
+ * Profile Init
+ * Enables the DWT cycle counter, SysTick is started by systick_init
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void profile_init(void);
+
+/*
+ * Profile Reset
+ * Clears the statistics of every phase
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void profile_reset(void);
+
+/*
+ * Profile Record
+ * Parameters:
+ * phase - phase that was timed
+ * cycles - cycles it took
+ *
+ * Returns:
+ * None
+ */
+void profile_record(profile_phase phase, uint32_t cycles);
+
+/*
+ * Profile Report
+ * Writes PROFILE_MAGIC, PROFILE_VERSION, PROFILE_PHASE_COUNT and then the
+ * profile_stats of every phase in order, little endian
+ *
+ * Parameters:
+ * uart - UART to write the report to
+ *
+ * Returns:
+ * None
+ */
+void profile_report(uint8_t uart);
+
+#else
+
+#define PROFILE_START(phase) ((void)0)
+#define PROFILE_STOP(phase) ((void)0)
+#define PROFILE_INIT() ((void)0)
+#define PROFILE_RESET() ((void)0)
+#define PROFILE_REPORT(uart) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+#include "record.h"
+
+#include <string.h>
+
+void record_init(record_header* record) {
+    // Erased flash reads 0xFF, so unused space is left that way
+    memset(record, 0xFF, RECORD_PAGE_SIZE);
+    record->magic = RECORD_MAGIC;
+    record->format = RECORD_FORMAT;
+    record->area_size = 0;
+}
+
+void* record_add(record_header* record, unsigned int tag, const void* value,
+                 uint16_t length) {
+    uint32_t offset = record->area_size;
+    uint32_t end = RECORD_ALIGN(offset + sizeof(record_field) + length);
+
+    if (tag >= RECORD_MAX_TAGS || record->offsets[tag] != RECORD_ABSENT ||
+        end > RECORD_AREA_SIZE) {
+        return 0;
+    }
+
+    uint8_t* area = (uint8_t*)(record + 1);
+    record_field* field = (record_field*)(area + offset);
+    field->tag = tag;
+    field->length = length;
+
+    // Padding is zeroed as well so the crc does not depend on old contents
+    memset(field + 1, 0, end - offset - sizeof(record_field));
+    if (value) {
+        memcpy(field + 1, value, length);
+    }
+
+    record->offsets[tag] = offset;
+    record->area_size = end;
+    return field + 1;
+}
+
+void record_finish(record_header* record) {
+    const uint8_t* start = (const uint8_t*)&record->format;
+    uint32_t len = sizeof(record_header) - (start - (const uint8_t*)record) +
+                   record->area_size;
+    record->crc = record_crc32(start, len);
+}
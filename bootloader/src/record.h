@@ -0,0 +1,240 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+/*
+ * Device record, kept in the metadata page at RECORD_ADDRESS. A fixed header
+ * is followed by an area of fields, each a record_field header and its
+ * value. The header maps every tag to the offset of its field, so any field
+ * is read without walking the area, and new tags can be added without moving
+ * the fields that already exist.
+ *
+ * There are two copies of the record, one page each, and the one with the
+ * higher sequence number is current. A new record is written over the other
+ * copy, so losing power while its page is erased or programmed leaves the
+ * current one in place.
+ *
+ * The firmware includes this file as well. It only needs record_newer,
+ * record_get and record_number, the rest is used by the bootloader to write
+ * the record.
+ */
+
+#define RECORD_ADDRESS 0xF800 // first copy, the second is the next page
+#define RECORD_COPIES 2
+#define RECORD_PAGE_SIZE 1024
+
+#define RECORD_MAGIC 0x5244424F // "OBDR"
+#define RECORD_FORMAT 1
+
+// Slots in the offset table, tags past RECORD_TAG_COUNT are free
+#define RECORD_MAX_TAGS 16
+#define RECORD_ABSENT 0xFFFF
+
+// Field tags, new tags go at the end
+typedef enum _record_tag {
+    RECORD_VERSION,         // uint16_t firmware version
+    RECORD_IMAGE_SIZE,      // uint32_t firmware size in bytes
+    RECORD_IMAGE_DIGEST,    // SHA-256 of the installed image, 32 bytes
+    RECORD_MESSAGE_ADDRESS, // uint32_t address of the release message
+    RECORD_MESSAGE_SIZE,    // uint16_t release message length, without its
+                            // null terminator
+    RECORD_INSTALL_COUNT,   // uint32_t images installed since the bootloader
+                            // was flashed
+    RECORD_FLAGS,           // uint16_t RECORD_FLAG_* bits
+    RECORD_IMAGE_SIGNATURE, // signature over the image, SIGNATURE_SIZE bytes
+    RECORD_MAC,             // HMAC-SHA256, always the last field
+    RECORD_SEQUENCE,        // uint32_t one more than the copy it replaced
+    RECORD_TAG_COUNT
+} record_tag;
+
+// RECORD_FLAGS bits: the image came with an image signature, or it is the
+// firmware embedded in the bootloader
+#define RECORD_FLAG_SIGNED 0x1
+#define RECORD_FLAG_BUILT_IN 0x2
+
+/*
+ * The crc covers everything after it up to the end of the used area. Offsets
+ * are from the start of the area and point at a record_field.
+ */
+typedef struct _record_header {
+    uint32_t magic;
+    uint32_t crc;
+    uint16_t format;
+    uint16_t area_size;
+    uint16_t offsets[RECORD_MAX_TAGS];
+} record_header;
+
+// Fields start on a 4 byte boundary so their values can be read in place
+typedef struct _record_field {
+    uint16_t tag;
+    uint16_t length;
+} record_field;
+
+#define RECORD_AREA_SIZE (RECORD_PAGE_SIZE - sizeof(record_header))
+#define RECORD_ALIGN(n) (((n) + 3) & ~3u)
+
+/*
+ * Record CRC32
+ * CRC-32 (IEEE 802.3) of a buffer, bit by bit to keep the code small
+ *
+ * Parameters:
+ * data - bytes to check
+ * len - number of bytes
+ *
+ * Returns:
+ * the CRC
+ */
+static inline uint32_t record_crc32(const uint8_t* data, uint32_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+/*
+ * Record Valid
+ * Parameters:
+ * record - record to check
+ *
+ * Returns:
+ * 1 if the record is complete and undamaged, 0 otherwise
+ */
+static inline int record_valid(const record_header* record) {
+    if (record->magic != RECORD_MAGIC || record->format != RECORD_FORMAT ||
+        record->area_size > RECORD_AREA_SIZE) {
+        return 0;
+    }
+
+    const uint8_t* start = (const uint8_t*)&record->format;
+    uint32_t len = sizeof(record_header) - (start - (const uint8_t*)record) +
+                   record->area_size;
+    return record_crc32(start, len) == record->crc;
+}
+
+/*
+ * Record Get
+ * Finds a field through the offset table, the record must be valid
+ *
+ * Parameters:
+ * record - record to read
+ * tag - field to find
+ * length - set to the length of the value, may be NULL
+ *
+ * Returns:
+ * the value of the field, NULL if the record does not have it
+ */
+static inline const void* record_get(const record_header* record,
+                                     unsigned int tag, uint16_t* length) {
+    if (tag >= RECORD_MAX_TAGS || record->offsets[tag] == RECORD_ABSENT ||
+        record->offsets[tag] + sizeof(record_field) > record->area_size) {
+        return 0;
+    }
+
+    const record_field* field =
+        (const record_field*)((const uint8_t*)(record + 1) +
+                              record->offsets[tag]);
+    if (field->tag != tag ||
+        record->offsets[tag] + sizeof(record_field) + field->length >
+            record->area_size) {
+        return 0;
+    }
+
+    if (length) {
+        *length = field->length;
+    }
+    return field + 1;
+}
+
+/*
+ * Record Number
+ * Reads a 16 or 32 bit field
+ *
+ * Parameters:
+ * record - record to read, must be valid
+ * tag - field to read
+ *
+ * Returns:
+ * the value, 0 if the record does not have the field
+ */
+static inline uint32_t record_number(const record_header* record,
+                                     unsigned int tag) {
+    uint16_t length;
+    const void* value = record_get(record, tag, &length);
+    if (value && length == sizeof(uint16_t)) {
+        return *(const uint16_t*)value;
+    }
+    if (value && length == sizeof(uint32_t)) {
+        return *(const uint32_t*)value;
+    }
+    return 0;
+}
+
+/*
+ * Record Newer
+ * Picks the current copy of the record
+ *
+ * Parameters:
+ * a, b - the two copies
+ *
+ * Returns:
+ * the valid copy with the higher sequence number, NULL if neither is valid
+ */
+static inline const record_header* record_newer(const record_header* a,
+                                                const record_header* b) {
+    if (!record_valid(a)) {
+        return record_valid(b) ? b : 0;
+    }
+    if (!record_valid(b)) {
+        return a;
+    }
+    return record_number(b, RECORD_SEQUENCE) > record_number(a, RECORD_SEQUENCE)
+               ? b
+               : a;
+}
+
+/*
+ * Record Init
+ * Starts an empty record
+ *
+ * Parameters:
+ * record - RECORD_PAGE_SIZE bytes to build the record in
+ *
+ * Returns:
+ * None
+ */
+void record_init(record_header* record);
+
+/*
+ * Record Add
+ * Appends a field, a tag can only be added once
+ *
+ * Parameters:
+ * record - record being built
+ * tag - tag of the field
+ * value - value to copy in, NULL leaves it zeroed to be filled in later
+ * length - length of the value
+ *
+ * Returns:
+ * the value in the record, NULL if the tag is taken or the area is full
+ */
+void* record_add(record_header* record, unsigned int tag, const void* value,
+                 uint16_t length);
+
+/*
+ * Record Finish
+ * Computes the crc, after which the record can be written to flash
+ *
+ * Parameters:
+ * record - record being built
+ *
+ * Returns:
+ * None
+ */
+void record_finish(record_header* record);
+
+#endif
@@ -58,6 +58,8 @@ static void IntDefaultHandler(void);
 //
 //******************************************************************************
 extern void UART0_IRQHandler(void);
+extern void UART1_IRQHandler(void);
+extern void SysTick_Handler(void);
 
 
 
@@ -71,10 +73,12 @@ extern int main(void);
 
 //*****************************************************************************
 //
-// Reserve space for the system stack.
+// Reserve space for the system stack.  BearSSL's signature verification
+// needs a few kilobytes of stack, and nothing large sits below the stack in
+// .bss anymore to absorb an overflow.
 //
 //*****************************************************************************
-static unsigned long pulStack[64];
+static unsigned long pulStack[2048];
 
 //*****************************************************************************
 //
@@ -101,14 +105,14 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // Debug monitor handler
     0,                                      // Reserved
     IntDefaultHandler,                      // The PendSV handler
-    IntDefaultHandler,                      // The SysTick handler
+    SysTick_Handler,                        // The SysTick handler
     IntDefaultHandler,                      // GPIO Port A
     IntDefaultHandler,                      // GPIO Port B
     IntDefaultHandler,                      // GPIO Port C
     IntDefaultHandler,                      // GPIO Port D
     IntDefaultHandler,                      // GPIO Port E
     UART0_IRQHandler,                      // UART0 Rx and Tx
-    IntDefaultHandler,                      // UART1 Rx and Tx
+    UART1_IRQHandler,                       // UART1 Rx and Tx
     IntDefaultHandler,                      // SSI0 Rx and Tx
     IntDefaultHandler,                      // I2C0 Master and Slave
     IntDefaultHandler,                      // PWM Fault
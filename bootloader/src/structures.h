@@ -1,11 +1,65 @@
 #include <stdint.h>
 
-#define SIGNATURE_SIZE 64
+// SIGNATURE_SIZE depends on the signature scheme
+#include "verify.h"
 
+// An update as the rest of the bootloader sees it, whichever format it
+// arrived in
 typedef struct _metadata
 {
     uint8_t signature[SIGNATURE_SIZE];
+    uint16_t version;
+    uint32_t size;
+    uint32_t message_size;
+} metadata;
+
+// Metadata of a v1 update, sent after its signature
+typedef struct _metadata_v1
+{
     uint16_t version;
     uint16_t size;
     uint16_t message_size;
-} metadata;
\ No newline at end of file
+} metadata_v1;
+
+// "OBC2" and the only container format this bootloader understands
+#define CONTAINER_MAGIC 0x3243424F
+#define CONTAINER_FORMAT 2
+#define CONTAINER_RESERVED_SIZE 16
+
+// Header of a v2 container, sent after its signature. payload is META,
+// PATCH or COMPRESSED. The reserved bytes are for extensions and must be
+// zero until a format uses them.
+typedef struct _container_header
+{
+    uint32_t magic;
+    uint16_t format;
+    uint16_t payload;
+    uint16_t version;
+    uint16_t pad;
+    uint32_t size;
+    uint32_t message_size;
+    uint8_t reserved[CONTAINER_RESERVED_SIZE];
+} container_header;
+
+// One bit per page of the 96 kB firmware slot
+#define DELTA_BITMAP_SIZE 12
+
+// Sent after the metadata of a delta update. The digests of the pages that
+// are kept follow it, then the changed pages arrive as firmware frames.
+typedef struct _delta_header
+{
+    uint16_t page_count;
+    uint16_t changed_count;
+    uint8_t changed[DELTA_BITMAP_SIZE];
+} delta_header;
+
+#define DELTA_PAGE_CHANGED(delta, page)                                        \
+    ((delta)->changed[(page) / 8] & (1 << ((page) % 8)))
+
+// Sent after the metadata of a compressed image. The compressed stream is
+// encrypted and sent as ordinary firmware frames.
+typedef struct _compression_header
+{
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+} compression_header;
@@ -0,0 +1,101 @@
+#include "trace.h"
+
+#include "utility.h"
+
+// Depth of the UART2 transmit FIFO
+#define TRACE_FIFO_SIZE 16
+
+// The most a poll sends at once. One slot stays free for text: trace_poll
+// runs from SysTick, and may interrupt a uart_write that has already seen
+// room in the FIFO but not yet stored its byte.
+#define TRACE_POLL_MAX (TRACE_FIFO_SIZE - 1)
+
+#define TRACE_EVENT_ARGC(event, level, argc, format) argc,
+static const uint8_t event_argc[TRACE_EVENT_COUNT] = {
+    TRACE_EVENTS(TRACE_EVENT_ARGC)};
+
+// Record ring. trace_emit only ever moves head and trace_poll only ever
+// moves tail, so no locking is needed.
+static uint8_t ring[TRACE_RING_SIZE];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+
+// Records lost to a full ring since the last TRACE_DROPPED record
+static uint32_t dropped = 0;
+
+static uint32_t record_size(trace_event event) {
+    return TRACE_HEADER_SIZE + event_argc[event] * sizeof(uint32_t);
+}
+
+// Writes a record if it fits, returns 0 if the ring is full
+static int put_record(trace_event event, const uint32_t* args) {
+    uint32_t h = head;
+    uint32_t size = record_size(event);
+    if (TRACE_RING_SIZE - (h - tail) < size) {
+        return 0;
+    }
+
+    uint16_t now = systick_ms();
+    uint8_t header[TRACE_HEADER_SIZE] = {TRACE_SYNC, event, now & 0xFF,
+                                         now >> 8};
+    const uint8_t* bytes = (const uint8_t*)args;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t b = i < TRACE_HEADER_SIZE ? header[i]
+                                          : bytes[i - TRACE_HEADER_SIZE];
+        ring[(h + i) & (TRACE_RING_SIZE - 1)] = b;
+    }
+
+    // Publish the record only once all of it is in the ring
+    COMPILER_BARRIER();
+    head = h + size;
+    return 1;
+}
+
+void trace_emit(trace_event event, uint32_t a, uint32_t b) {
+    uint32_t args[TRACE_MAX_ARGS] = {a, b};
+
+    // Report what was lost as soon as there is room again
+    if (dropped) {
+        if (!put_record(TRACE_DROPPED, &dropped)) {
+            dropped++;
+            return;
+        }
+        dropped = 0;
+    }
+
+    if (!put_record(event, args)) {
+        dropped++;
+    }
+}
+
+void trace_poll(void) {
+    if (!hal_uart_tx_empty(UART2)) {
+        return;
+    }
+
+    uint32_t t = tail;
+    uint32_t sent = 0;
+    while (t != head) {
+        trace_event event = ring[(t + 1) & (TRACE_RING_SIZE - 1)];
+        uint32_t size = record_size(event);
+        if (sent + size > TRACE_POLL_MAX) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < size; i++) {
+            // Never blocks, the FIFO has room for every byte sent here
+            uart_write(UART2, ring[(t + i) & (TRACE_RING_SIZE - 1)]);
+        }
+        t += size;
+        sent += size;
+    }
+
+    COMPILER_BARRIER();
+    tail = t;
+}
+
+void trace_flush(void) {
+    while (tail != head) {
+        CPU_IDLE_WHILE(tail != head);
+    }
+}
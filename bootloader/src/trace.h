@@ -0,0 +1,121 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary trace records for the hot paths of an update, built in with
+ * "make TRACE=<level>". Events above the level, and every event when TRACE is
+ * not set, compile to nothing. Kept events are queued in a RAM ring as
+ * records and sent on UART2 from the SysTick interrupt, between the lines of
+ * text the rest of the bootloader writes there. tools/trace_decode.py turns
+ * them back into text.
+ *
+ * A record is TRACE_SYNC, the event, the low 16 bits of systick_ms() and then
+ * the event's arguments as 32-bit values, little endian. TRACE_SYNC is never
+ * part of the ASCII text on UART2, so the decoder finds records by it.
+ */
+
+#define TRACE_OFF 0
+#define TRACE_ERROR 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_OFF
+#endif
+
+#define TRACE_SYNC 0xA5
+#define TRACE_HEADER_SIZE 4
+#define TRACE_MAX_ARGS 2
+
+// Size of the record ring, must be a power of two
+#define TRACE_RING_SIZE 1024
+
+/*
+ * X(event, level, argument count, format). New events go at the end, the
+ * event number is the position in this list. trace_decode.py reads the list
+ * from this file and fills the arguments into the format with str.format.
+ */
+#define TRACE_EVENTS(X)                                                        \
+    X(TRACE_DROPPED, TRACE_ERROR, 1, "[TRACE] {} records dropped")            \
+    X(TRACE_FRAME_WAIT, TRACE_DEBUG, 1, "[FIRMWARE] Waiting for frame at {}") \
+    X(TRACE_FRAME_RECEIVED, TRACE_DEBUG, 2,                                    \
+      "[FIRMWARE] Frame at {} received, {} bytes")                             \
+    X(TRACE_PAGE_STAGED, TRACE_DEBUG, 2,                                       \
+      "[FIRMWARE] Staged {1} bytes at {0:#x}")                                 \
+    X(TRACE_JOURNAL_COMMIT, TRACE_INFO, 1, "[JOURNAL] {} bytes staged")
+
+#define TRACE_EVENT_ID(event, level, argc, format) event,
+typedef enum _trace_event {
+    TRACE_EVENTS(TRACE_EVENT_ID) TRACE_EVENT_COUNT
+} trace_event;
+
+// <event>_LEVEL for every event, so filtering happens at compile time
+#define TRACE_EVENT_LEVEL(event, level, argc, format) event##_LEVEL = level,
+enum _trace_event_level {
+    TRACE_EVENTS(TRACE_EVENT_LEVEL)
+};
+
+#if TRACE_LEVEL > TRACE_OFF
+
+#define TRACE1(event, a) TRACE2(event, a, 0)
+#define TRACE2(event, a, b)                                                    \
+    do                                                                         \
+    {                                                                          \
+        if (event##_LEVEL <= TRACE_LEVEL)                                      \
+            trace_emit(event, (uint32_t)(a), (uint32_t)(b));                   \
+    } while (0)
+
+#define TRACE_POLL() trace_poll()
+#define TRACE_FLUSH() trace_flush()
+
+/*
+ * Trace Emit
+ * Queues a record, or counts it as dropped if the ring is full
+ *
+ * Parameters:
+ * event - event to record
+ * a, b - arguments, only as many as the event has are kept
+ *
+ * Returns:
+ * None
+ */
+void trace_emit(trace_event event, uint32_t a, uint32_t b);
+
+/*
+ * Trace Poll
+ * Sends queued records while the UART2 transmit FIFO is empty, whole
+ * records only so text written in between can never split one. A byte of
+ * the FIFO is left for text a poll interrupts. Called from SysTick_Handler.
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void trace_poll(void);
+
+/*
+ * Trace Flush
+ * Waits until every queued record has been sent
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void trace_flush(void);
+
+#else
+
+#define TRACE1(event, a) ((void)0)
+#define TRACE2(event, a, b) ((void)0)
+#define TRACE_POLL() ((void)0)
+#define TRACE_FLUSH() ((void)0)
+
+#endif
+
+#endif
@@ -6,11 +6,11 @@
 void reject()
 {
     // Re-enable interrupts if they were disabled
-    IntMasterEnable();
+    hal_irq_enable();
 
     // We failed, oh no...
     uart_write(UART1, ERROR); 
-    SysCtlReset();
+    hal_reset();
 }
 
 void uart_write_hex_bytes(uint8_t uart, uint8_t* start, uint32_t len) {
@@ -37,26 +37,3 @@ void uart_write_hex_bytes(uint8_t uart, uint8_t* start, uint32_t len) {
         uart_write_str(uart, " "); // uncomment if you want space between your bytes
     }
 }
-
-
-
-void uart_read_wrp(uint8_t uart, int blocking, int* read, uint8_t* out, size_t bytes)
-{
-    // Hope that the out variable is a valid pointer and read a byte
-    // UART register only holds up to a byte so we have to repeat this operation X times
-    for (int i = 0; i < bytes; ++i) {
-        volatile uint8_t data = uart_read(uart, blocking , read);
-        memcpy(out + i, (uint8_t*)(&data), 1);
-    }
-}
-
-void uart_write_wrp(uint8_t uart, uint8_t* in, size_t bytes)
-{
-    // Same thing as uart_read_wrp except we write...
-    for (int i = 0; i < bytes; ++i) {
-        volatile uint8_t data = {0};
-        memcpy(&data, in + i, 1);
-
-        uart_write(uart, data);
-    }
-}
\ No newline at end of file
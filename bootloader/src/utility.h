@@ -7,9 +7,21 @@
 #include <ctype.h>
 
 #include "uart.h"
-#include "inc/hw_types.h" 
-#include "driverlib/interrupt.h"
-#include "driverlib/sysctl.h"
+#include "hal.h"
+
+// Size of the UART1 receive ring, must be a power of two
+#define UART_RX_RING_SIZE 4096
+
+// Rate uart_init() sets up, UART1 falls back to it after a failed switch
+#define UART_DEFAULT_BAUD 115200
+
+// Timeout value that makes uart_read_bulk wait until all bytes arrive
+#define UART_WAIT_FOREVER 0xFFFFFFFF
+
+// Stops the compiler from moving memory accesses across this point
+#define COMPILER_BARRIER() __asm volatile("" ::: "memory")
+
+// CPU_IDLE_WHILE() is in hal.h, it sleeps differently on every backend
 
 
 void uart_write_hex_bytes(uint8_t uart, uint8_t* start, uint32_t len);
@@ -17,30 +29,113 @@ void uart_write_hex_bytes(uint8_t uart, uint8_t* start, uint32_t len);
 
 
 /*
- * UART Read
+ * SysTick Init
+ * Starts the 1 ms system tick used for timeouts
+ *
  * Parameters:
- * uart - uart port 
- * blocking - wait until data is read before continuing
- * read - true if data was read succesfully, false otherwise
- * out - output buffer
- * bytes - amount of bytes to read
- * 
+ * None
+ *
  * Returns:
- * data is written to the output buffer
+ * None
  */
-void uart_read_wrp(uint8_t uart, int blocking, int* read, uint8_t* out, size_t bytes);
+void systick_init(void);
 
 /*
- * UART Write
+ * SysTick Milliseconds
  * Parameters:
- * uart - uart port 
- * in - input buffer
- * bytes - amount of bytes to write
- * 
+ * None
+ *
+ * Returns:
+ * milliseconds elapsed since systick_init, wraps after ~49 days
+ */
+uint32_t systick_ms(void);
+
+#ifdef PROFILE_SYSTICK
+/*
+ * SysTick Cycles
+ * Only in builds profiled with SysTick, see hal_lm3s.c
+ *
+ * Parameters:
+ * None
+ *
  * Returns:
+ * clock cycles elapsed since systick_init, wraps like the DWT cycle counter
+ */
+uint32_t systick_cycles(void);
+#endif
+
+/*
+ * UART RX Init
+ * Enables the UART1 receive interrupt which fills the receive ring.
+ * uart_init(UART1) must be called first.
+ *
+ * Parameters:
  * None
+ *
+ * Returns:
+ * None
+ */
+void uart_rx_init(void);
+
+/*
+ * UART Bulk Read
+ * Copies bytes received on UART1 out of the receive ring
+ *
+ * Parameters:
+ * dst - output buffer
+ * n - amount of bytes to read
+ * timeout - milliseconds to wait for all n bytes, or UART_WAIT_FOREVER
+ *
+ * Returns:
+ * amount of bytes written to dst, less than n if the timeout expired
+ */
+size_t uart_read_bulk(uint8_t* dst, size_t n, uint32_t timeout);
+
+/*
+ * UART Bulk Write
+ * Parameters:
+ * uart - uart port
+ * src - input buffer
+ * n - amount of bytes to write
+ *
+ * Returns:
+ * None, returns once every byte is queued in the TX FIFO
+ */
+void uart_write_bulk(uint8_t uart, const uint8_t* src, size_t n);
+
+/*
+ * UART RX Flush
+ * Drops every byte waiting in the UART1 receive ring
+ *
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * None
+ */
+void uart_rx_flush(void);
+
+/*
+ * UART Set Baud
+ * Waits for UART1 to finish sending, then switches it to a new rate
+ *
+ * Parameters:
+ * baud - new rate in bits per second
+ *
+ * Returns:
+ * None
+ */
+void uart_set_baud(uint32_t baud);
+
+/*
+ * UART Get Baud
+ * Parameters:
+ * None
+ *
+ * Returns:
+ * current UART1 rate in bits per second
  */
-void uart_write_wrp(uint8_t uart, uint8_t* in, size_t bytes);
+uint32_t uart_get_baud(void);
 
 /*
  * Reject
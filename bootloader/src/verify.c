@@ -0,0 +1,45 @@
+#include "verify.h"
+
+#include <string.h>
+
+#include "beaverssl.h"
+
+// The public keys are defined in secrets.h, which only bootloader.c includes
+
+#if SIGNATURE_SCHEME == SIGNATURE_ECDSA_P256
+
+extern const br_ec_public_key EC_PUBLIC;
+
+int verify_signature(const uint8_t* hash, const uint8_t* signature) {
+    return br_ecdsa_i31_vrfy_raw(&br_ec_p256_m31, hash, 32, &EC_PUBLIC,
+                                 signature, SIGNATURE_SIZE) == 1;
+}
+
+#elif SIGNATURE_SCHEME == SIGNATURE_RSA_PKCS1
+
+extern const br_rsa_public_key RSA_PUBLIC;
+
+int verify_signature(const uint8_t* hash, const uint8_t* signature) {
+    // PKCS#1 v1.5 recovers the signed digest, which still has to match
+    uint8_t signed_hash[32];
+    if (!br_rsa_i31_pkcs1_vrfy(signature, SIGNATURE_SIZE, BR_HASH_OID_SHA256,
+                               sizeof(signed_hash), &RSA_PUBLIC, signed_hash)) {
+        return 0;
+    }
+
+    return memcmp(signed_hash, hash, sizeof(signed_hash)) == 0;
+}
+
+#elif SIGNATURE_SCHEME == SIGNATURE_RSA_PSS
+
+extern const br_rsa_public_key RSA_PUBLIC;
+
+int verify_signature(const uint8_t* hash, const uint8_t* signature) {
+    return br_rsa_i31_pss_vrfy(signature, SIGNATURE_SIZE, &br_sha256_vtable,
+                               &br_sha256_vtable, hash, PSS_SALT_SIZE,
+                               &RSA_PUBLIC) == 1;
+}
+
+#else
+#error "Unknown SIGNATURE_SCHEME, rerun bl_build.py"
+#endif
@@ -0,0 +1,28 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+// Signature schemes bl_build.py can select with --signature
+#define SIGNATURE_ECDSA_P256 1
+#define SIGNATURE_RSA_PKCS1 2
+#define SIGNATURE_RSA_PSS 3
+
+// SIGNATURE_SCHEME and SIGNATURE_SIZE, generated by bl_build.py
+#include "../crypto/signature.h"
+
+/*
+ * Verify Signature
+ * Checks a signature over a SHA-256 digest with the public key built into
+ * the bootloader
+ *
+ * Parameters:
+ * hash - 32 byte SHA-256 digest of the signed data
+ * signature - SIGNATURE_SIZE bytes of signature
+ *
+ * Returns:
+ * 1 if the signature is valid, 0 otherwise
+ */
+int verify_signature(const uint8_t* hash, const uint8_t* signature);
+
+#endif
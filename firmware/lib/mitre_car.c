@@ -5,6 +5,7 @@
 #include "uart.h"
 #include "usart.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 static const char *STARTUP_BANNER =
@@ -38,8 +39,80 @@ static const char *HELP_TEXT =
     " * FLAG - ???\n"
     "\n";
 
+// A console command and the function that answers it
+typedef struct
+{
+    const char *name;
+    void (*handler)(void);
+} command;
+
+static void helpCommand(void)
+{
+    write(HELP_TEXT);
+}
+
+static void emissionsCommand(void)
+{
+    writeLine("Now that you mention it, the smoke usually isn't that color...");
+}
+
+static void safetyCommand(void)
+{
+    writeLine("System normal.");
+}
+
+static void infotainmentCommand(void)
+{
+    writeLine("Playing video: https://www.youtube.com/watch?v=dQw4w9WgXcQ");
+}
+
+static void securityCommand(void)
+{
+    writeLine("No viruses detected. Signatures last updated 1/1/1970.\n"
+              "Firewall disabled because it stops the airbags from "
+              "deploying.");
+}
+
+// Sorted by name, parseCommand finds commands with a binary search. Keep
+// it sorted when adding one, DEBUG builds check it at startup.
+static const command COMMANDS[] =
+{
+    {"EMISSIONS", emissionsCommand},
+    {"FLAG", flagCommand},
+    {"HELP", helpCommand},
+    {"INFOTAINMENT", infotainmentCommand},
+    {"SAFETY", safetyCommand},
+    {"SECURITY", securityCommand},
+    {"VERSION", versionCommand},
+};
+
+#define COMMAND_COUNT (sizeof(COMMANDS) / sizeof(COMMANDS[0]))
+
+static int compareCommand(const void *name, const void *entry)
+{
+    return strcmp(name, ((const command *)entry)->name);
+}
+
+#ifdef DEBUG
+// bsearch quietly misses commands past an entry that is out of order
+static void checkCommands(void)
+{
+    for(unsigned int i = 1; i < COMMAND_COUNT; i++)
+    {
+        if(strcmp(COMMANDS[i - 1].name, COMMANDS[i].name) >= 0)
+        {
+            write("COMMANDS is not sorted at ");
+            writeLine(COMMANDS[i].name);
+        }
+    }
+}
+#endif
+
 void printBanner()
 {
+#ifdef DEBUG
+    checkCommands();
+#endif
     write(STARTUP_BANNER);
 }
 
@@ -54,29 +127,18 @@ int prompt(char* buffer, int max_bytes)
 
 void parseCommand(char* buffer, int len)
 {
-    if(strncmp(buffer, "HELP", len) == 0)
-    {
-        write(HELP_TEXT);
-    }
-    else if(strncmp(buffer, "EMISSIONS", len) == 0)
-    {
-        writeLine("Now that you mention it, the smoke usually isn't that color...");
-    }
-    else if(strncmp(buffer, "SAFETY", len) == 0)
-    {
-        writeLine("System normal.");
-    }
-    else if(strncmp(buffer, "INFOTAINMENT", len) == 0)
+    // An empty line just prompts again
+    if(len == 0)
     {
-        writeLine("Playing video: https://www.youtube.com/watch?v=dQw4w9WgXcQ");
+        return;
     }
-    else if(strncmp(buffer, "SECURITY", len) == 0)
+
+    const command *found = bsearch(buffer, COMMANDS, COMMAND_COUNT,
+                                   sizeof(COMMANDS[0]), compareCommand);
+    if(found)
     {
-        writeLine("No viruses detected. Signatures last updated 1/1/1970.\n"
-                  "Firewall disabled because it stops the airbags from "
-                  "deploying.");
+        found->handler();
     }
-    else if(strncmp(buffer, "FLAG", len) == 0);
     else
     {
         writeLine("Command not recognized. Use \"HELP\" for a listing.");
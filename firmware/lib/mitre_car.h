@@ -4,3 +4,7 @@
 void printBanner(void);
 void parseCommand(char* buffer, int len);
 int prompt(char* buffer, int max_bytes);
+
+// Commands the firmware answers itself
+void flagCommand(void);
+void versionCommand(void);
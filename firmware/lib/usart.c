@@ -4,43 +4,166 @@
 #include "usart.h"
 #include "uart.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/uart.h"
+
+// Console rings on UART2, both powers of two. The transmit ring holds the
+// whole startup banner, so printing it never waits on the line.
+#define TX_RING_SIZE 2048
+#define RX_RING_SIZE 256
+
+// UART2_IRQHandler moves rx_head and tx_tail, the application moves rx_tail
+// and tx_head. tx_tail is also moved by startTx, with the UART2 interrupt
+// masked.
+static uint8_t tx_ring[TX_RING_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+static uint8_t rx_ring[RX_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+// Keep the compiler from moving ring accesses across index updates
+#define COMPILER_BARRIER() __asm volatile("" ::: "memory")
+
+// Sleeps while the ring index at *index equals value. Interrupts are masked
+// around the check, so one that moves the index in between still wakes the
+// core: WFI returns on a pending interrupt, which runs once they are unmasked.
+static void sleepWhileEqual(volatile uint32_t *index, uint32_t value)
+{
+    for (;;)
+    {
+        IntMasterDisable();
+        if (*index != value)
+        {
+            IntMasterEnable();
+            return;
+        }
+        __asm volatile("wfi" ::: "memory");
+        IntMasterEnable();
+    }
+}
+
+// Move queued bytes into the TX FIFO while it has room
+static void fillTxFifo(void)
+{
+    uint32_t tail = tx_tail;
+    while (tail != tx_head && UARTSpaceAvail(UART2_BASE))
+    {
+        UARTCharPutNonBlocking(UART2_BASE, tx_ring[tail & (TX_RING_SIZE - 1)]);
+        tail++;
+    }
+    tx_tail = tail;
+
+    // The TX interrupt is only wanted while there is more to send
+    if (tail == tx_head)
+    {
+        UARTIntDisable(UART2_BASE, UART_INT_TX);
+    }
+    else
+    {
+        UARTIntEnable(UART2_BASE, UART_INT_TX);
+    }
+}
+
+// Start sending what write() queued, if the interrupt is not already at it
+static void startTx(void)
+{
+    IntDisable(INT_UART2);
+    fillTxFifo();
+    IntEnable(INT_UART2);
+}
+
+void UART2_IRQHandler(void)
+{
+    UARTIntClear(UART2_BASE, UARTIntStatus(UART2_BASE, true));
+
+    // Drain the RX FIFO, dropping bytes if the ring is full
+    uint32_t head = rx_head;
+    while (UARTCharsAvail(UART2_BASE))
+    {
+        uint8_t data = UARTCharGetNonBlocking(UART2_BASE);
+        if (head - rx_tail < RX_RING_SIZE)
+        {
+            rx_ring[head & (RX_RING_SIZE - 1)] = data;
+            head++;
+        }
+    }
+    COMPILER_BARRIER();
+    rx_head = head;
+
+    fillTxFifo();
+}
+
+static char readByte(void)
+{
+    sleepWhileEqual(&rx_head, rx_tail);
+    COMPILER_BARRIER();
+
+    char received_byte = rx_ring[rx_tail & (RX_RING_SIZE - 1)];
+    COMPILER_BARRIER();
+    rx_tail++;
+    return received_byte;
+}
+
 int readLine(char *buffer, int max_bytes)
 {
     int i;
-    int ret;
-    for (i = 0;i < max_bytes; ++i)
+    // Leave room for the terminator, the line is cut short if it is longer
+    for (i = 0; i < max_bytes - 1; ++i)
     {
-        // Fetch the received byte value into the variable "received_byte".
-        char received_byte = uart_read(UART2, 1, &ret);
-        // If the line has ended, terminate the string and break. Otherwise,
-        // store the byte and contintue.
+        char received_byte = readByte();
+        // If the line has ended, stop. Otherwise, store the byte and continue.
         if(received_byte == '\n' || received_byte == '\r')
         {
-            buffer[i] = '\0';
             break;
         }
-        else
-        {
-            buffer[i] = received_byte;
-        }
+        buffer[i] = received_byte;
     }
+    buffer[i] = '\0';
 
-    // Reture number of bytes received (length of string).
+    // Return number of bytes received (length of string).
     return i;
 }
 
 void write(const char *buffer)
 {
-    uart_write_str(UART2, (char *) buffer); // Send the byte.
+    while (*buffer)
+    {
+        // Only a full ring waits, for the interrupt to send some of it
+        if (tx_head - tx_tail == TX_RING_SIZE)
+        {
+            startTx();
+            sleepWhileEqual(&tx_tail, tx_head - TX_RING_SIZE);
+        }
+
+        tx_ring[tx_head & (TX_RING_SIZE - 1)] = *buffer++;
+        COMPILER_BARRIER();
+        tx_head++;
+    }
+
+    startTx();
 }
 
 void writeLine(const char *buffer)
 {
     write(buffer);
-    nl(UART2);
+    write("\n");
 }
 
 void initializeUSART()
 {
     uart_init(UART2);
+
+    // Interrupt when the RX FIFO is half full or the line goes idle, and
+    // when the TX FIFO is nearly empty
+    UARTFIFOLevelSet(UART2_BASE, UART_FIFO_TX1_8, UART_FIFO_RX4_8);
+    UARTIntEnable(UART2_BASE, UART_INT_RX | UART_INT_RT);
+    IntEnable(INT_UART2);
 }
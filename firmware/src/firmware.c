@@ -3,11 +3,15 @@
 
 #include <string.h>
 
+#include "inc/hw_ints.h"
+#include "driverlib/interrupt.h"
+
 #define VERSION_2
 #include "usart.h"
 #include "uart.h"
 #include "util.h"
 #include "mitre_car.h"
+#include "record.h"
 
 static const char *FLAG_RESPONSE = "Nice try.";
 
@@ -16,18 +20,61 @@ void getFlag(char *flag)
     flag = strcpy(flag, FLAG_RESPONSE);
 }
 
-int main(void) __attribute__((section(".text.main")));
+void flagCommand(void)
+{
+    char flag[32];
+    getFlag(flag);
+    writeLine(flag);
+}
+
+// Write a field of the device record as a decimal number
+void writeRecordNumber(const char *label, const record_header *record,
+                       unsigned int tag)
+{
+    char digits[11];
+    int i = sizeof(digits) - 1;
+    uint32_t value = record_number(record, tag);
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    write(label);
+    writeLine(digits + i);
+}
+
+// Print the version and install count the bootloader recorded
+void versionCommand(void)
+{
+    const record_header *record = record_newer(
+        (const record_header *)RECORD_ADDRESS,
+        (const record_header *)(RECORD_ADDRESS + RECORD_PAGE_SIZE));
+    if (!record)
+    {
+        writeLine("No device record");
+        return;
+    }
+
+    writeRecordNumber("Version: ", record, RECORD_VERSION);
+    writeRecordNumber("Installs: ", record, RECORD_INSTALL_COUNT);
+}
+
 int main (void)
 {
+    // The bootloader hands over with every interrupt off. A space on UART0
+    // still resets the device.
+    uart_init(UART0);
+    IntEnable(INT_UART0);
+    initializeUSART();
+    IntMasterEnable();
+
     printBanner();
     for(;;) // Loop forever.
     {
         char buff[256];
-        int len = prompt(buff, 256);
-        if(buff[0] != '\0' && strncmp(buff, "FLAG", len) == 0)
-        {
-            getFlag(buff);
-            writeLine(buff);
-        }
+        prompt(buff, 256);
     }
 }
@@ -13,7 +13,8 @@ import shutil
 from subprocess import run, call
 from util import arrayize
 
-from Crypto.PublicKey import ECC
+import signature
+
 from Crypto.Random import get_random_bytes
 
 # various project directories
@@ -27,6 +28,12 @@ CRYPTO_DIR = BOOTLOADER_DIR / "crypto"
 SECRET_ERROR = -1
 FIRMWARE_ERROR = -2
 
+# --trace levels, TRACE_ERROR to TRACE_DEBUG in bootloader/src/trace.h
+TRACE_LEVELS = {"error": 1, "info": 2, "debug": 3}
+
+# --profile clocks, the DWT cycle counter or SysTick, which QEMU models
+PROFILE_CLOCKS = {"dwt": "1", "systick": "systick"}
+
 
 def copy_initial_firmware(binary_path):
     # Navigate to our tool directory
@@ -40,7 +47,7 @@ def copy_initial_firmware(binary_path):
 
 
 # compile the bootloader
-def make_bootloader(**keys) -> bool:
+def make_bootloader(profile=None, trace=None, **keys) -> bool:
     # Navigate to bootloader directory
     os.chdir(BOOTLOADER_DIR)
 
@@ -49,6 +56,10 @@ def make_bootloader(**keys) -> bool:
 
     # Create a make command including all the keys passed
     command = "make "
+    if profile:
+        command += f"PROFILE={PROFILE_CLOCKS[profile]} "
+    if trace:
+        command += f"TRACE={TRACE_LEVELS[trace]} "
     variables = [f"{x}='{arrayize(y)}'" for x, y in keys.items()]
     for variable in variables:
         command += variable + " "
@@ -66,65 +77,115 @@ def make_bootloader(**keys) -> bool:
     return status == 0
 
 
-def generate_secrets():
+def generate_secrets(scheme=signature.DEFAULT_SCHEME):
     try:
         # Generate our random symmetric AES key & initalization vector
         aes = get_random_bytes(32)
         iv = get_random_bytes(16)
 
-        # ECC key pair generation, curve is NIST P-256
-        # export the public key
-        ecc_private = ECC.generate(curve="secp256r1")
-        ecc_public = ecc_private.public_key()
-        exported_public = ecc_public.export_key(format="raw")
+        # Device-only key that MACs the boot record, never leaves the build
+        record_key = get_random_bytes(32)
+
+        # Signing key pair for the selected scheme, ECDSA keys are on NIST
+        # P-256, RSA keys are 2048 bits with e = 65537
+        private_key = signature.generate_key(scheme)
+        exported_public = signature.export_public_key(private_key, scheme)
 
         # Make a crypto folder if it doesn't exist already
         if not os.path.exists(CRYPTO_DIR):
             os.mkdir(CRYPTO_DIR)
 
-        # Write our AES and ECC private key
+        # Write our AES and private key
         with open(CRYPTO_DIR / "secret_build_output.txt", mode="wb") as file:
             file.write(aes)
-            file.write(bytes(ecc_private.export_key(format="PEM").encode()))
+            file.write(signature.export_private_key(private_key))
 
-        # Create a .RAW file to store our RAW public key
-        with open(CRYPTO_DIR / "ecc_public.raw", mode="wb") as file:
+        # Store the public key for fw_update
+        with open(CRYPTO_DIR / signature.PUBLIC_KEY_FILES[scheme], mode="wb") as file:
             file.write(exported_public)
 
+        # Record the scheme for fw_protect and fw_update
+        with open(CRYPTO_DIR / signature.SCHEME_FILE, mode="w") as file:
+            file.write(scheme)
+
         # Lastly, store our IV
         with open(CRYPTO_DIR / "iv.txt", mode="wb") as file:
             file.write(iv)
 
+        # The scheme and signature size are needed wherever metadata is
+        # parsed, so they get a header without any definitions
+        with open(CRYPTO_DIR / "signature.h", mode="wb") as file:
+            file.write(b"#ifndef SIGNATURE_H\n")
+            file.write(b"#define SIGNATURE_H\n\n")
+            file.write(b"// Selected with bl_build.py --signature\n")
+            file.write(
+                f"#define SIGNATURE_SCHEME {signature.C_SCHEMES[scheme]}\n".encode()
+            )
+            file.write(
+                f"#define SIGNATURE_SIZE {signature.SCHEMES[scheme]}\n".encode()
+            )
+            if scheme == "rsa-pss":
+                file.write(
+                    f"#define PSS_SALT_SIZE {signature.PSS_SALT_SIZE}\n".encode()
+                )
+            file.write(b"\n#endif")
+
         # Makefile command line constants don't work so we opted to use a header file
         with open(CRYPTO_DIR / "secrets.h", mode="wb") as file:
             file.write(b"#ifndef SECRETS_H\n")
             file.write(b"#define SECRETS_H\n\n")
 
-            file.write(b"// Needed for ECC Public Key structure\n")
+            file.write(b"// Needed for the public key structures\n")
             file.write(b'#include "beaverssl.h"\n\n')
 
             file.write(b"// Size constants\n")
             file.write(b"#define MAX_VERSION 65535\n")
             file.write(b"#define MAX_MESSAGE_SIZE 1000\n")
-            file.write(b"#define MAX_FIRMWARE_SIZE 30000\n")
+            # v1 metadata can only describe 64000 bytes, v2 containers fill
+            # the 96kB slot up to the release message and padding
+            file.write(b"#define MAX_FIRMWARE_SIZE 97280\n")
             file.write(b"#define AES_KEY_LENGTH 32\n")
             file.write(b"#define IV_KEY_LENGTH 16\n")
-            file.write(b"#define ECC_KEY_LENGTH 65\n\n")
+            file.write(b"#define RECORD_KEY_LENGTH 32\n")
+            if scheme == "ecdsa":
+                file.write(b"#define ECC_KEY_LENGTH 65\n")
+            file.write(b"\n")
 
             file.write(
                 f"const uint8_t AES_KEY[AES_KEY_LENGTH] = {arrayize(aes)};\n".encode()
             )
             file.write(f"uint8_t IV_KEY[IV_KEY_LENGTH] = {arrayize(iv)};\n".encode())
             file.write(
-                f"const uint8_t ECC_PUBLIC_KEY[ECC_KEY_LENGTH] = {arrayize(exported_public)};\n".encode()
+                f"const uint8_t RECORD_KEY[RECORD_KEY_LENGTH] = {arrayize(record_key)};\n".encode()
             )
-            file.write(b"const br_ec_public_key EC_PUBLIC = {\n")
-            file.write(b"\t.curve = BR_EC_secp256r1,\n")
-            file.write(b"\t.q = (void*)(ECC_PUBLIC_KEY),\n")
-            file.write(b"\t.qlen = sizeof(ECC_PUBLIC_KEY)\n};")
+            if scheme == "ecdsa":
+                file.write(
+                    f"const uint8_t ECC_PUBLIC_KEY[ECC_KEY_LENGTH] = {arrayize(exported_public)};\n".encode()
+                )
+                file.write(b"const br_ec_public_key EC_PUBLIC = {\n")
+                file.write(b"\t.curve = BR_EC_secp256r1,\n")
+                file.write(b"\t.q = (void*)(ECC_PUBLIC_KEY),\n")
+                file.write(b"\t.qlen = sizeof(ECC_PUBLIC_KEY)\n};")
+                public_keys = {"ECC_PUBLIC_KEY": exported_public}
+            else:
+                # BearSSL takes the modulus and exponent as big-endian bytes
+                modulus = private_key.n.to_bytes(signature.RSA_BITS // 8, "big")
+                exponent = private_key.e.to_bytes(3, "big")
+                file.write(
+                    f"const uint8_t RSA_MODULUS[] = {arrayize(modulus)};\n".encode()
+                )
+                file.write(
+                    f"const uint8_t RSA_EXPONENT[] = {arrayize(exponent)};\n".encode()
+                )
+                file.write(b"const br_rsa_public_key RSA_PUBLIC = {\n")
+                file.write(b"\t.n = (void*)(RSA_MODULUS),\n")
+                file.write(b"\t.nlen = sizeof(RSA_MODULUS),\n")
+                file.write(b"\t.e = (void*)(RSA_EXPONENT),\n")
+                file.write(b"\t.elen = sizeof(RSA_EXPONENT)\n};")
+                public_keys = {"RSA_MODULUS": modulus, "RSA_EXPONENT": exponent}
             file.write(b"\n#endif")
 
-        return {"AES_KEY": aes, "IV_KEY": iv, "ECC_PUBLIC_KEY": exported_public}
+        return {"AES_KEY": aes, "IV_KEY": iv, "RECORD_KEY": record_key, **public_keys}
 
     # No point of trying to compile if we don't have any secrets
     except Exception as excep:
@@ -153,17 +214,37 @@ def main(args):
         )
 
     # Set up secrets
-    secrets = generate_secrets()
+    secrets = generate_secrets(args.signature)
 
     # Move the initial firmware
     copy_initial_firmware(binary_path)
 
     # Run make commands (we couldn't get Makefile constants to work so the kwargs is actually useless..)
-    make_bootloader(**secrets)
+    make_bootloader(args.profile, args.trace, **secrets)
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Bootloader Build Tool")
     parser.add_argument("--initial-firmware", help="Path to the the firmware binary.")
+    parser.add_argument(
+        "--signature",
+        help="Signature scheme the bootloader verifies updates with.",
+        choices=sorted(signature.SCHEMES),
+        default=signature.DEFAULT_SCHEME,
+    )
+    parser.add_argument(
+        "--profile",
+        help="Time each phase of an update and report it on UART2, see profile_report.py.",
+        nargs="?",
+        const="dwt",
+        choices=list(PROFILE_CLOCKS),
+        default=None,
+    )
+    parser.add_argument(
+        "--trace",
+        help="Send trace events up to this level on UART2, see trace_decode.py.",
+        choices=list(TRACE_LEVELS),
+        default=None,
+    )
     args = parser.parse_args()
     main(args)
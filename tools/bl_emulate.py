@@ -5,20 +5,38 @@
 
 import argparse
 import pathlib
+import shutil
 import subprocess
 import os
-from util import UART0_PATH, UART1_PATH, UART2_PATH
+import time
+from util import UART0_PATH, UART1_PATH, UART2_PATH, instance_dir, uart_paths
 
 
-def emulate(binary_path, debug=False):
-    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-nographic", "-kernel", binary_path]
+def qemu_command(binary_path, paths, debug=False, headless=False, icount=None):
+    cmd = ["qemu-system-arm", "-M", "lm3s6965evb", "-kernel", binary_path]
+
+    # -icount ties the guest clock to instructions executed, so cycle counts
+    # no longer depend on how fast the host is
+    if icount is not None:
+        cmd.extend(["-icount", f"shift={icount}"])
+
+    # -nographic puts the monitor on the terminal, which instances running
+    # side by side cannot share
+    if headless:
+        cmd.extend(["-display", "none", "-monitor", "none"])
+    else:
+        cmd.append("-nographic")
 
     if debug:
         cmd.extend(["-s", "-S"])
 
-    uart_paths = ["/embsec/UART0", "/embsec/UART1", "/embsec/UART2"]
-    for i in range(3):
-        cmd.extend(["-serial", f"unix:{uart_paths[i]},server"])
+    for path in paths:
+        cmd.extend(["-serial", f"unix:{path},server"])
+    return cmd
+
+
+def emulate(binary_path, debug=False):
+    cmd = qemu_command(binary_path, [UART0_PATH, UART1_PATH, UART2_PATH], debug)
 
     # Try to kill and delete leftover stuff before starting qemu
     os.system("pkill qemu")
@@ -42,6 +60,34 @@ def emulate(binary_path, debug=False):
     subprocess.Popen(cmd)
 
 
+# Start count instances, each with its own directory under fleet_dir for
+# its UART sockets. Only QEMU processes started here are ever stopped, so
+# several fleets (or the default instance) can run side by side.
+def emulate_fleet(binary_path, count, fleet_dir):
+    fleet_dir = pathlib.Path(fleet_dir)
+    processes = []
+    for index in range(count):
+        directory = instance_dir(fleet_dir, index)
+        shutil.rmtree(directory, ignore_errors=True)
+        directory.mkdir(parents=True)
+
+        # The board keeps its flash in guest memory, so every instance starts
+        # from the bootloader image. Running each one from its own directory
+        # keeps anything QEMU writes next to it private as well.
+        cmd = qemu_command(binary_path, uart_paths(directory), headless=True)
+        processes.append(
+            subprocess.Popen(cmd, cwd=directory, stdin=subprocess.DEVNULL)
+        )
+    return processes
+
+
+def stop_fleet(processes):
+    for process in processes:
+        process.terminate()
+    for process in processes:
+        process.wait()
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Stellaris Emulator")
     parser.add_argument(
@@ -52,6 +98,17 @@ if __name__ == "__main__":
         help="Start GDB server and break on first instruction",
         action="store_true",
     )
+    parser.add_argument(
+        "--instances",
+        help="Start this many instances, see --fleet-dir.",
+        type=int,
+        default=None,
+    )
+    parser.add_argument(
+        "--fleet-dir",
+        help="Directory for the UART sockets of each instance.",
+        default="/tmp/obsidian-fleet",
+    )
     args = parser.parse_args()
     if args.boot_path is None:
         binary_path = (
@@ -60,4 +117,16 @@ if __name__ == "__main__":
     else:
         binary_path = pathlib.Path(args.boot_path)
 
-    emulate(binary_path.resolve(), debug=args.debug)
+    if args.instances is None:
+        emulate(binary_path.resolve(), debug=args.debug)
+    else:
+        processes = emulate_fleet(
+            binary_path.resolve(), args.instances, args.fleet_dir
+        )
+        print(f"Started {args.instances} instances in {args.fleet_dir}")
+        try:
+            while all(process.poll() is None for process in processes):
+                time.sleep(0.5)
+        except KeyboardInterrupt:
+            pass
+        stop_fleet(processes)
@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+"""
+Native Bootloader Runner
+
+Runs the bootloader built with "make native" in place of the emulator. The
+UARTs are served on the same sockets QEMU uses, so fw_update.py and the other
+tools work unchanged. Like QEMU, it waits for a client on UART0, UART1 and
+UART2 in that order before the bootloader starts. Flash is kept in a file,
+see bootloader/src/hal_host.c.
+"""
+
+import argparse
+import os
+import pathlib
+import socket
+import subprocess
+
+from util import UART0_PATH, UART1_PATH, UART2_PATH
+
+BOOTLOADER_DIR = pathlib.Path(__file__).parent / ".." / "bootloader"
+
+# Descriptor hal_host.c reads UART0 from
+UART0_FD = 3
+
+
+def accept_uart(path):
+    pathlib.Path(path).parent.mkdir(parents=True, exist_ok=True)
+    try:
+        os.unlink(path)
+    except FileNotFoundError:
+        pass
+
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    server.bind(path)
+    server.listen(1)
+    print(f"Waiting for a connection on {path}")
+    connection, _ = server.accept()
+    server.close()
+    return connection
+
+
+def run_native(binary_path, flash_path):
+    uart0, uart1, uart2 = (
+        accept_uart(path) for path in (UART0_PATH, UART1_PATH, UART2_PATH)
+    )
+
+    env = dict(os.environ, OBSIDIAN_FLASH=str(flash_path))
+    process = subprocess.Popen(
+        [binary_path],
+        stdin=uart1,
+        stdout=uart1,
+        stderr=uart2,
+        env=env,
+        close_fds=False,
+        preexec_fn=lambda: os.dup2(uart0.fileno(), UART0_FD),
+    )
+    for uart in (uart0, uart1, uart2):
+        uart.close()
+    return process.wait()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Native Bootloader Runner")
+    parser.add_argument(
+        "--boot-path",
+        help="Path to the native bootloader.",
+        default=BOOTLOADER_DIR / "host" / "bootloader",
+    )
+    parser.add_argument(
+        "--flash",
+        help="Flash file, created erased if it does not exist.",
+        default="/tmp/obsidian-flash.bin",
+    )
+    parser.add_argument(
+        "--erase", help="Start from erased flash.", action="store_true"
+    )
+    args = parser.parse_args()
+
+    if args.erase:
+        pathlib.Path(args.flash).unlink(missing_ok=True)
+
+    status = run_native(pathlib.Path(args.boot_path).resolve(), args.flash)
+    print(f"Bootloader exited with status {status}")
@@ -0,0 +1,186 @@
+#!/usr/bin/env python
+"""
+Fleet Updater Tool
+
+Pushes one protected bundle to every instance started by
+bl_emulate.py --instances, at most --concurrency at a time. Each device is
+driven by the same UpdateEngine as fw_update.py, in a worker thread, while
+asyncio schedules the devices and collects their results.
+
+Every device gets a BenchTelemetry, so the summary has its time, throughput
+and retries next to whether it succeeded. --json writes the same summary as
+JSON.
+"""
+
+import argparse
+import asyncio
+import json
+import time
+
+from util import DomainSocketSerial, instance_dir, uart_paths
+
+import fw_update
+
+
+# Connect to one instance and run the whole update, returning its summary
+def update_device(name, directory, bundle, window, boot, baud, log):
+    uart0_path, uart1_path, uart2_path = uart_paths(directory)
+    sockets = []
+    try:
+        # QEMU waits for each socket in turn, so all three are connected
+        # before the unused ones are closed
+        for path in (uart0_path, uart1_path, uart2_path):
+            sockets.append(fw_update.connect_uart(path))
+        sockets[0].close()
+        sockets[2].close()
+
+        ser = DomainSocketSerial(sockets[1])
+        telemetry = fw_update.BenchTelemetry()
+        engine = fw_update.UpdateEngine(
+            ser,
+            bundle.signature,
+            bundle.metadata,
+            bundle.firmware,
+            window,
+            boot,
+            False,
+            kind=bundle.kind,
+            extension=bundle.extension,
+            baud=baud,
+            telemetry=telemetry,
+            log=lambda message: log(f"[{name}] {message}"),
+        )
+        engine.run()
+
+        report = telemetry.report(
+            len(bundle.firmware), bundle.kind, engine.window, ser.baudrate
+        )
+        return {
+            "device": name,
+            "ok": True,
+            "seconds": report["seconds"],
+            "bytes_per_s": report["throughput"]["update_bytes_per_s"],
+            "retries": sum(report["retries"].values()),
+        }
+    finally:
+        for sock in sockets:
+            sock.close()
+
+
+async def update_fleet(devices, bundle, concurrency, window, boot, baud, log):
+    limit = asyncio.Semaphore(concurrency)
+
+    async def run(name, directory):
+        async with limit:
+            start = time.monotonic()
+            try:
+                return await asyncio.to_thread(
+                    update_device, name, directory, bundle, window, boot, baud, log
+                )
+            # Whatever goes wrong is this device's failure, the rest of the
+            # fleet carries on
+            except Exception as excep:
+                return {
+                    "device": name,
+                    "ok": False,
+                    "seconds": time.monotonic() - start,
+                    "error": str(excep) or type(excep).__name__,
+                }
+
+    return await asyncio.gather(
+        *(run(name, directory) for name, directory in devices)
+    )
+
+
+def print_summary(results, seconds, firmware_size):
+    print(f"{'device':<10}{'result':<8}{'seconds':>9}{'bytes/s':>10}{'retries':>9}")
+    for result in results:
+        if result["ok"]:
+            print(
+                f"{result['device']:<10}{'ok':<8}{result['seconds']:>9.2f}"
+                f"{result['bytes_per_s']:>10.0f}{result['retries']:>9}"
+            )
+        else:
+            print(
+                f"{result['device']:<10}{'failed':<8}{result['seconds']:>9.2f}"
+                f"  {result['error']}"
+            )
+
+    updated = sum(result["ok"] for result in results)
+    print(
+        f"{updated} of {len(results)} devices updated in {seconds:.2f}s, "
+        f"{updated * firmware_size / seconds:.0f} bytes/s across the fleet."
+    )
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Fleet Update Tool")
+    parser.add_argument(
+        "--firmware",
+        help="Path to firmware image to load.",
+        default="../firmware/gcc/protected_firmware.bin",
+    )
+    parser.add_argument(
+        "--fleet-dir",
+        help="Directory given to bl_emulate.py --fleet-dir.",
+        default="/tmp/obsidian-fleet",
+    )
+    parser.add_argument(
+        "--instances", help="Number of instances to update.", type=int, required=True
+    )
+    parser.add_argument(
+        "--concurrency",
+        help="Devices updated at the same time.",
+        type=int,
+        default=4,
+    )
+    parser.add_argument(
+        "--window",
+        help="Frames to keep in flight, 0 for stop-and-wait.",
+        type=int,
+        default=fw_update.DEFAULT_WINDOW,
+    )
+    parser.add_argument(
+        "--boot",
+        help="Boot the new firmware once it is installed.",
+        action="store_true",
+        default=False,
+    )
+    parser.add_argument(
+        "--baud",
+        help="Propose a faster UART1 rate for the update.",
+        type=int,
+        default=None,
+    )
+    parser.add_argument(
+        "--verbose", help="Print the progress of every device.", action="store_true"
+    )
+    parser.add_argument("--json", help="Also write the summary to this file.")
+    args = parser.parse_args()
+
+    bundle = fw_update.load_bundle(args.firmware)
+    devices = [
+        (f"device{index}", instance_dir(args.fleet_dir, index))
+        for index in range(args.instances)
+    ]
+    log = print if args.verbose else lambda message: None
+
+    start = time.monotonic()
+    results = asyncio.run(
+        update_fleet(
+            devices,
+            bundle,
+            args.concurrency,
+            args.window,
+            args.boot,
+            args.baud,
+            log,
+        )
+    )
+    seconds = time.monotonic() - start
+
+    print_summary(results, seconds, len(bundle.firmware))
+    if args.json:
+        with open(args.json, "w") as fp:
+            json.dump({"seconds": seconds, "devices": results}, fp, indent=2)
+            fp.write("\n")
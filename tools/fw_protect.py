@@ -1,19 +1,107 @@
 #!/usr/bin/env python
 """
 Firmware Bundle-and-Protect Tool
+
+A protected image is laid out as:
+
+[ 0x40 ]      [ 0x06 ]   [ 0x40 ]          [ 0x20 ]     [ variable ]
+-----------------------------------------------------------------
+| Signature | Metadata | Image signature | Chain head | Image... |
+-----------------------------------------------------------------
+
+The signature covers everything after it up to and including the chain head.
+The image is the firmware, release message and a null terminator, encrypted.
+The image signature covers an IMAGE byte, the firmware and message sizes and
+the plain image. The bootloader keeps it in the boot record so the installed
+image can be checked again at boot.
+
+The chain head authenticates the data sent after it, in FRAME_SIZE frames.
+Going backwards from an all zero hash after the last frame, each frame's link
+is SHA256(frame + link of the next frame), and the head is the link of the
+first frame. fw_update.py sends each frame with the link of the next one, so
+the bootloader checks every frame with one hash as it arrives, once it has
+checked the signature over the head.
+
+With --base, the output is a delta bundle against the protected image that is
+currently deployed. Only the 1kB flash pages that differ are sent, along with
+digests of the pages the bootloader keeps:
+
+[ 0x04 ]  [ 0x40 ]      [ 0x06 ]   [ 0x40 ]    [ 0x10 ]  [ 0x20 * kept ]  [ 0x20 ]  [ variable ]
+-------------------------------------------------------------------------------------------------
+| Magic | Signature | Metadata | Image sig | Delta hdr | Kept page hashes | Chain  | Pages... |
+-------------------------------------------------------------------------------------------------
+
+The delta header holds the page count of the new image, the number of changed
+pages and a bitmap of which pages changed. The changed pages are padded with
+0xFF to a full page and encrypted back to back. The signature covers a leading
+PATCH byte and everything after the signature up to the chain head, except the
+magic.
+
+With --compress, the image and release message are LZSS compressed before they
+are encrypted:
+
+[ 0x04 ]  [ 0x40 ]      [ 0x06 ]   [ 0x40 ]    [ 0x08 ]  [ 0x20 ]  [ variable ]
+-------------------------------------------------------------------------------
+| Magic | Signature | Metadata | Image sig | Sizes   | Chain  | Compressed... |
+-------------------------------------------------------------------------------
+
+The sizes are the compressed and uncompressed lengths as 32-bit integers. The
+signature covers a leading COMPRESSED byte and everything after the signature
+up to the chain head, except the magic. See bootloader/src/lzss.h for the stream format.
+
+The signature and image signature sizes above are for ECDSA. With an RSA scheme selected in
+bl_build.py, signatures are 0x100 bytes, see signature.py.
+
+The 6 byte metadata limits images to 64000 bytes. Larger images, or any
+image with --format 2, go in a v2 container instead, with 32-bit lengths:
+
+[ 0x24 ]             [ 0x40 ]      [ 0x40 ]    [ variable ]
+-----------------------------------------------------------------
+| Container header | Signature | Image sig | Payload...       |
+-----------------------------------------------------------------
+
+The header is the magic "OBC2", the format (2), the payload type (META,
+PATCH or COMPRESSED), the version, the firmware and message sizes as 32-bit
+integers and 16 reserved bytes, which must be zero. The payload is laid out
+as in the v1 bundle of the same type, without its magic. The signature
+covers a leading CONTAINER byte, the header and everything after the
+signature up to the chain head. The header comes first so fw_update.py can tell the formats
+apart; it is sent after the signature, as v1 metadata is.
+
+With --manifest, every entry of a JSON list is protected, spread over --jobs
+worker processes that each load the keys once:
+
+[
+    {"infile": "main.bin", "outfile": "v2.prot", "version": 2, "message": "hi"},
+    {"infile": "main.bin", "outfile": "v2.delta", "version": 2, "message": "hi",
+     "base": "v1.prot"},
+    {"infile": "main.bin", "outfile": "v2.lz", "version": 2, "message": "hi",
+     "compress": true},
+    {"infile": "big.bin", "outfile": "v3.prot", "version": 3, "message": "hi",
+     "format": 2}
+]
+
+Relative paths are taken from the manifest's directory. Outputs are cached
+under the hash of the inputs, version, message, options and build secrets,
+so an entry whose inputs have not changed is copied from the cache instead of
+being protected again.
 """
 
 import argparse
+import concurrent.futures
+import json
+import os
 import pathlib
+import shutil
 import struct
 
 from Crypto.Cipher import AES
 from Crypto.Hash import SHA256
-from Crypto.PublicKey import ECC
-from Crypto.Signature import DSS
 
 from Crypto.Util.Padding import pad, unpad
 
+import signature
+
 # crypto directory, where keys generated by bl_build are stored
 CRYPTO_DIR = (
     pathlib.Path(__file__).parent.parent.joinpath("bootloader/crypto").absolute()
@@ -22,81 +110,560 @@ CRYPTO_DIR = (
 # max size of unsigned short
 MAX_VERSION = 2**16 - 1
 
-# from challenge outline document
+# from challenge outline document; v1 metadata bounds the firmware size with
+# its 16-bit size field, v2 containers fill the bootloader's 96kB slot up to
+# the release message and padding
 MAX_MESSAGE_SIZE = 1000
-MAX_FIRMWARE_SIZE = 30000
+MAX_V1_FIRMWARE_SIZE = 64000
+MAX_FIRMWARE_SIZE = 97280
 
 # AES-256 key length
 AES_KEY_LEN = 32
 
+# deltas are made of whole flash pages
+FLASH_PAGESIZE = 1024
 
-def protect_firmware(infile, outfile, version, message):
-    # Read firmware binary after it is compiled by bl_build
-    with open(infile, "rb") as infile:
-        firmware = infile.read()
+# one bit per page of the bootloader's 96kB firmware slot
+DELTA_BITMAP_SIZE = 12
 
-    # check that message and firmware length within project description
-    # and that version can be packed as a short
-    assert version <= MAX_VERSION
-    assert len(message) <= MAX_MESSAGE_SIZE
-    assert len(firmware) <= MAX_FIRMWARE_SIZE
+# payload of a full image
+META = b"M"
+
+# marks a delta bundle for fw_update, it is not sent to the bootloader
+DELTA_MAGIC = b"ODLT"
+PATCH = b"P"
+
+# data is sent and authenticated in frames of this size, see chain_head
+FRAME_SIZE = 256
+CHAIN_LINK_SIZE = 32
+
+# v2 containers, see bootloader/src/structures.h
+CONTAINER = b"V"
+CONTAINER_MAGIC = b"OBC2"
+CONTAINER_FORMAT = 2
+CONTAINER_RESERVED_SIZE = 16
+CONTAINER_HEADER_FORMAT = f"<4sHHHHII{CONTAINER_RESERVED_SIZE}s"
+CONTAINER_HEADER_SIZE = struct.calcsize(CONTAINER_HEADER_FORMAT)
+
+# leads the data an image signature covers
+IMAGE = b"I"
+
+# marks a compressed bundle, see bootloader/src/lzss.h for the parameters
+COMPRESSED_MAGIC = b"OLZC"
+COMPRESSED = b"Z"
+LZSS_WINDOW_SIZE = 4096
+LZSS_MIN_MATCH = 3
+LZSS_MAX_MATCH = 18
+
+# candidates examined per position, bounds the compression time
+LZSS_MAX_CHAIN = 256
+
+# where --manifest keeps protected outputs by the hash of their inputs
+DEFAULT_CACHE_DIR = CRYPTO_DIR / "protect_cache"
+
+# bump when the output for the same inputs changes, which drops old entries
+CACHE_FORMAT_VERSION = 3
+
+# --format choices, None picks the smallest format that fits
+FORMATS = {None: None, 1: False, 2: True}
+
+# keys loaded by each --manifest worker process
+_worker_keys = None
 
+
+def load_keys():
     # Extract keys from secret build output 32 bytes AES
-    # then ECC private key is the rest of the file
+    # then the private key of the selected scheme is the rest of the file
     # Public key not needed for signing; not loaded
+    scheme = signature.read_scheme(CRYPTO_DIR)
     with open(CRYPTO_DIR / "secret_build_output.txt", mode="rb") as secfile:
         aes_key = secfile.read(AES_KEY_LEN)
         priv_key = secfile.read()
-        priv_key = ECC.import_key(priv_key)
+        priv_key = signature.import_private_key(priv_key, scheme)
 
     # Extract initalization vector (IV) generated by bl_build
     with open(CRYPTO_DIR / "iv.txt", mode="rb") as ivfile:
         iv = ivfile.read()
 
-    # Pack version, length of firmware, and size into 3 little-endian shorts
-    # makes 6 byte metadata
-    metadata = struct.pack("<HHH", version, len(firmware), len(message))
+    return aes_key, priv_key, iv, scheme
+
+
+def read_protected_image(path, aes_key, iv):
+    # Recover the firmware, release message and null terminator exactly as the
+    # bootloader installed them
+    with open(path, "rb") as infile:
+        blob = infile.read()
+
+    # The signatures are as long as the selected scheme makes them
+    signature_size = signature.SCHEMES[signature.read_scheme(CRYPTO_DIR)]
+
+    if blob.startswith(CONTAINER_MAGIC):
+        header = struct.unpack(CONTAINER_HEADER_FORMAT, blob[:CONTAINER_HEADER_SIZE])
+        payload, size, message_size = header[2], header[5], header[6]
+        if payload != META[0]:
+            raise ValueError(f"{path} is not a full image, the base must be one.")
+        offset = CONTAINER_HEADER_SIZE + 2 * signature_size
+        ciphertext = blob[offset + CHAIN_LINK_SIZE :]
+    elif blob.startswith(DELTA_MAGIC) or blob.startswith(COMPRESSED_MAGIC):
+        raise ValueError(f"{path} is not a full image, the base must be one.")
+    else:
+        offset = signature_size
+        _, size, message_size = struct.unpack("<HHH", blob[offset : offset + 6])
+        ciphertext = blob[offset + 6 + signature_size + CHAIN_LINK_SIZE :]
 
-    # AES-256 cipher, CBC
     aes = AES.new(aes_key, AES.MODE_CBC, iv=iv)
+    image = unpad(aes.decrypt(ciphertext), 16)
+    return image[: size + message_size + 1]
+
+
+def paginate(image):
+    # Flash pages as the bootloader leaves them, erased bytes read as 0xFF
+    return [
+        image[start : start + FLASH_PAGESIZE].ljust(FLASH_PAGESIZE, b"\xff")
+        for start in range(0, len(image), FLASH_PAGESIZE)
+    ]
+
 
-    # ECDSA signer, P-256 curve, for integrity and authenticity
-    signer = DSS.new(priv_key, mode="fips-186-3")
+def lzss_compress(data):
+    # Greedy LZSS, the longest match is found through a chain of earlier
+    # positions that start with the same three bytes
+    out = bytearray()
+    chains = {}
+    group = bytearray()
+    flags = 0
+    count = 0
+    pos = 0
 
-    # metadata plus aes of firmware and message, padded and null-terminated
-    # sign all of that and prepend signature
-    blob = metadata + aes.encrypt(pad(firmware + message.encode() + b"\x00", 16))
+    def remember(i):
+        if i + LZSS_MIN_MATCH <= len(data):
+            chains.setdefault(data[i : i + LZSS_MIN_MATCH], []).append(i)
 
-    # signs SHA-256 hash
-    h = SHA256.new(blob)
-    blob = signer.sign(h) + blob
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        limit = min(LZSS_MAX_MATCH, len(data) - pos)
+        if limit >= LZSS_MIN_MATCH:
+            candidates = chains.get(data[pos : pos + LZSS_MIN_MATCH], [])
+            for start in reversed(candidates[-LZSS_MAX_CHAIN:]):
+                if pos - start > LZSS_WINDOW_SIZE:
+                    break
+                length = LZSS_MIN_MATCH
+                while length < limit and data[start + length] == data[pos + length]:
+                    length += 1
+                if length > best_len:
+                    best_len, best_dist = length, pos - start
+                    if length == limit:
+                        break
+
+        if best_len >= LZSS_MIN_MATCH:
+            # 12-bit distance - 1, then 4-bit length - 3
+            distance = best_dist - 1
+            group.append(distance & 0xFF)
+            group.append((distance >> 8) << 4 | (best_len - LZSS_MIN_MATCH))
+            for i in range(pos, pos + best_len):
+                remember(i)
+            pos += best_len
+        else:
+            flags |= 1 << count
+            group.append(data[pos])
+            remember(pos)
+            pos += 1
+
+        count += 1
+        if count == 8:
+            out += bytes([flags]) + group
+            group, flags, count = bytearray(), 0, 0
+
+    if count:
+        out += bytes([flags]) + group
+    return bytes(out)
+
+
+def sign_image(priv_key, scheme, firmware, message):
+    # The bootloader checks this against the installed image at boot
+    image = firmware + message.encode() + b"\x00"
+    sizes = struct.pack("<II", len(firmware), len(message))
+    return signature.sign(priv_key, scheme, SHA256.new(IMAGE + sizes + image))
+
+
+def use_container(firmware, container):
+    # None picks v1 whenever the image fits in it, so older bootloaders can
+    # still install it
+    if container is None:
+        return len(firmware) > MAX_V1_FIRMWARE_SIZE
+    if not container and len(firmware) > MAX_V1_FIRMWARE_SIZE:
+        raise ValueError(
+            f"{len(firmware)} bytes do not fit in v1 metadata, use --format 2."
+        )
+    return container
+
+
+def pack_metadata(container, payload, version, size, message_size):
+    if not container:
+        # Pack version, length of firmware, and size into 3 little-endian
+        # shorts makes 6 byte metadata
+        return struct.pack("<HHH", version, size, message_size)
+    return struct.pack(
+        CONTAINER_HEADER_FORMAT,
+        CONTAINER_MAGIC,
+        CONTAINER_FORMAT,
+        payload[0],
+        version,
+        0,
+        size,
+        message_size,
+        bytes(CONTAINER_RESERVED_SIZE),
+    )
+
+
+def chain_head(data):
+    # Link of the first frame, each link hashes its frame and the next link
+    link = bytes(CHAIN_LINK_SIZE)
+    starts = range(0, len(data), FRAME_SIZE)
+    for start in reversed(starts):
+        link = SHA256.new(data[start : start + FRAME_SIZE] + link).digest()
+    return link
+
+
+def write_bundle(
+    outfile, priv_key, scheme, container, payload, metadata, headers, data
+):
+    # signs SHA-256 hash with the scheme bl_build selected, for integrity
+    # and authenticity. Everything but a v1 image is signed with its header
+    # byte in front. The data sent in frames is covered by the chain head.
+    signed = metadata + headers + chain_head(data)
+    if container:
+        sig = signature.sign(priv_key, scheme, SHA256.new(CONTAINER + signed))
+        blob = metadata + sig + signed[len(metadata) :] + data
+    else:
+        prefix = b"" if payload == META else payload
+        sig = signature.sign(priv_key, scheme, SHA256.new(prefix + signed))
+        magic = {META: b"", PATCH: DELTA_MAGIC, COMPRESSED: COMPRESSED_MAGIC}[payload]
+        blob = magic + sig + signed + data
 
-    # write protected firmware blob into outfile
     with open(outfile, "wb") as outfile:
         outfile.write(blob)
 
 
+def protect_firmware(infile, outfile, version, message, keys=None, container=None):
+    # Read firmware binary after it is compiled by bl_build
+    with open(infile, "rb") as infile:
+        firmware = infile.read()
+
+    # check that message and firmware length within project description
+    # and that version can be packed as a short
+    assert version <= MAX_VERSION
+    assert len(message) <= MAX_MESSAGE_SIZE
+    assert len(firmware) <= MAX_FIRMWARE_SIZE
+    container = use_container(firmware, container)
+
+    aes_key, priv_key, iv, scheme = keys or load_keys()
+
+    metadata = pack_metadata(container, META, version, len(firmware), len(message))
+
+    # AES-256 cipher, CBC
+    aes = AES.new(aes_key, AES.MODE_CBC, iv=iv)
+
+    # aes of firmware and message, padded and null-terminated, after the
+    # image signature
+    image_sig = sign_image(priv_key, scheme, firmware, message)
+    ciphertext = aes.encrypt(pad(firmware + message.encode() + b"\x00", 16))
+
+    write_bundle(
+        outfile, priv_key, scheme, container, META, metadata, image_sig, ciphertext
+    )
+
+
+def protect_delta(
+    infile, outfile, version, message, base, keys=None, container=None
+):
+    with open(infile, "rb") as infile:
+        firmware = infile.read()
+
+    assert version <= MAX_VERSION
+    assert len(message) <= MAX_MESSAGE_SIZE
+    assert len(firmware) <= MAX_FIRMWARE_SIZE
+    container = use_container(firmware, container)
+
+    aes_key, priv_key, iv, scheme = keys or load_keys()
+
+    # Compare the new image with the deployed one page by page
+    new_pages = paginate(firmware + message.encode() + b"\x00")
+    base_pages = paginate(read_protected_image(base, aes_key, iv))
+    assert len(new_pages) <= DELTA_BITMAP_SIZE * 8
+
+    changed = [
+        i
+        for i, page in enumerate(new_pages)
+        if i >= len(base_pages) or base_pages[i] != page
+    ]
+
+    bitmap = bytearray(DELTA_BITMAP_SIZE)
+    for i in changed:
+        bitmap[i // 8] |= 1 << (i % 8)
+
+    metadata = pack_metadata(container, PATCH, version, len(firmware), len(message))
+    header = struct.pack(
+        f"<HH{DELTA_BITMAP_SIZE}s", len(new_pages), len(changed), bytes(bitmap)
+    )
+
+    # The bootloader checks these against flash before changing anything
+    kept_hashes = b"".join(
+        SHA256.new(base_pages[i]).digest()
+        for i in range(len(new_pages))
+        if i not in changed
+    )
+
+    aes = AES.new(aes_key, AES.MODE_CBC, iv=iv)
+    pages = aes.encrypt(b"".join(new_pages[i] for i in changed))
+
+    image_sig = sign_image(priv_key, scheme, firmware, message)
+    write_bundle(
+        outfile,
+        priv_key,
+        scheme,
+        container,
+        PATCH,
+        metadata,
+        image_sig + header + kept_hashes,
+        pages,
+    )
+
+    print(f"Delta: {len(changed)} of {len(new_pages)} pages changed.")
+
+
+def protect_compressed(
+    infile, outfile, version, message, keys=None, container=None
+):
+    with open(infile, "rb") as infile:
+        firmware = infile.read()
+
+    assert version <= MAX_VERSION
+    assert len(message) <= MAX_MESSAGE_SIZE
+    assert len(firmware) <= MAX_FIRMWARE_SIZE
+    container = use_container(firmware, container)
+
+    aes_key, priv_key, iv, scheme = keys or load_keys()
+
+    image = firmware + message.encode() + b"\x00"
+    compressed = lzss_compress(image)
+
+    metadata = pack_metadata(
+        container, COMPRESSED, version, len(firmware), len(message)
+    )
+    sizes = struct.pack("<II", len(compressed), len(image))
+
+    aes = AES.new(aes_key, AES.MODE_CBC, iv=iv)
+    image_sig = sign_image(priv_key, scheme, firmware, message)
+    write_bundle(
+        outfile,
+        priv_key,
+        scheme,
+        container,
+        COMPRESSED,
+        metadata,
+        image_sig + sizes,
+        aes.encrypt(pad(compressed, 16)),
+    )
+
+    print(f"Compressed: {len(image)} bytes to {len(compressed)} bytes.")
+
+
+def secrets_digest():
+    # Outputs made with other keys or another scheme must not be reused
+    h = SHA256.new(signature.read_scheme(CRYPTO_DIR).encode())
+    for name in ("secret_build_output.txt", "iv.txt"):
+        with open(CRYPTO_DIR / name, "rb") as fp:
+            h.update(SHA256.new(fp.read()).digest())
+    return h.hexdigest()
+
+
+def file_digest(path):
+    with open(path, "rb") as fp:
+        return SHA256.new(fp.read()).hexdigest()
+
+
+def read_manifest(path):
+    with open(path) as fp:
+        entries = json.load(fp)
+
+    root = pathlib.Path(path).parent
+    for entry in entries:
+        for name in ("infile", "outfile", "base"):
+            if entry.get(name) is not None:
+                entry[name] = str(root / entry[name])
+        entry["version"] = int(entry["version"])
+        entry["compress"] = bool(entry.get("compress", False))
+        entry["format"] = entry.get("format")
+        if entry["format"] not in (None, 1, 2):
+            raise ValueError(f"{entry['outfile']}: unknown format {entry['format']}")
+        entry.setdefault("base", None)
+        if entry["compress"] and entry["base"] is not None:
+            raise ValueError(f"{entry['outfile']}: compress cannot be combined with base")
+    return entries
+
+
+def cache_key(entry, secrets):
+    # Content addressed, file names do not matter
+    inputs = {
+        "cache": CACHE_FORMAT_VERSION,
+        "secrets": secrets,
+        "infile": file_digest(entry["infile"]),
+        "base": file_digest(entry["base"]) if entry["base"] else None,
+        "compress": entry["compress"],
+        "version": entry["version"],
+        "message": entry["message"],
+        "bundle_format": entry["format"],
+    }
+    return SHA256.new(json.dumps(inputs, sort_keys=True).encode()).hexdigest()
+
+
+def _init_worker():
+    global _worker_keys
+    _worker_keys = load_keys()
+
+
+def _protect_entry(entry):
+    arguments = dict(
+        infile=entry["infile"],
+        outfile=entry["outfile"],
+        version=entry["version"],
+        message=entry["message"],
+        keys=_worker_keys,
+        container=FORMATS[entry["format"]],
+    )
+    if entry["compress"]:
+        protect_compressed(**arguments)
+    elif entry["base"] is not None:
+        protect_delta(base=entry["base"], **arguments)
+    else:
+        protect_firmware(**arguments)
+
+
+def protect_manifest(manifest, jobs=None, cache_dir=DEFAULT_CACHE_DIR):
+    entries = read_manifest(manifest)
+
+    # Entries found in the cache are copied out, the rest are protected
+    pending = []
+    if cache_dir is not None:
+        cache_dir = pathlib.Path(cache_dir)
+        cache_dir.mkdir(parents=True, exist_ok=True)
+        secrets = secrets_digest()
+    for entry in entries:
+        cached = None
+        if cache_dir is not None:
+            cached = cache_dir / (cache_key(entry, secrets) + ".bin")
+            if cached.is_file():
+                shutil.copyfile(cached, entry["outfile"])
+                print(f"{entry['outfile']}: cached")
+                continue
+        pending.append((entry, cached))
+
+    with concurrent.futures.ProcessPoolExecutor(
+        max_workers=jobs, initializer=_init_worker
+    ) as pool:
+        futures = {
+            pool.submit(_protect_entry, entry): (entry, cached)
+            for entry, cached in pending
+        }
+        for future in concurrent.futures.as_completed(futures):
+            entry, cached = futures[future]
+            future.result()
+            if cached is not None:
+                # Written under a temporary name so an interrupted copy is
+                # never taken for a complete entry
+                partial = cached.with_suffix(".tmp")
+                shutil.copyfile(entry["outfile"], partial)
+                os.replace(partial, cached)
+            print(f"{entry['outfile']}: protected")
+
+    print(f"{len(entries)} entries, {len(entries) - len(pending)} from the cache.")
+
+
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description="Firmware Update Tool")
+    parser.add_argument("--infile", help="Path to the firmware image to protect.")
+    parser.add_argument("--outfile", help="Filename for the output firmware.")
+    parser.add_argument("--version", help="Version number of this firmware.")
+    parser.add_argument("--message", help="Release message for this firmware.")
     parser.add_argument(
-        "--infile", help="Path to the firmware image to protect.", required=True
+        "--base",
+        help="Protected image currently deployed, outputs a delta against it.",
+        default=None,
     )
     parser.add_argument(
-        "--outfile", help="Filename for the output firmware.", required=True
+        "--compress",
+        help="Compress the firmware and message, cannot be combined with --base.",
+        action="store_true",
     )
     parser.add_argument(
-        "--version", help="Version number of this firmware.", required=True
+        "--manifest",
+        help="JSON list of images to protect, instead of --infile and the rest.",
+        default=None,
     )
     parser.add_argument(
-        "--message", help="Release message for this firmware.", required=True
+        "--jobs",
+        help="Worker processes for --manifest, one per core by default.",
+        type=int,
+        default=None,
     )
-    args = parser.parse_args()
-    protect_firmware(
-        infile=args.infile,
-        outfile=args.outfile,
-        version=int(args.version),
-        message=args.message
+    parser.add_argument(
+        "--cache",
+        help="Cache directory for --manifest.",
+        default=str(DEFAULT_CACHE_DIR),
+    )
+    parser.add_argument(
+        "--no-cache",
+        help="Protect every --manifest entry, even unchanged ones.",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--format",
+        help="Bundle format, v1 unless the image needs a v2 container by default.",
+        type=int,
+        choices=[1, 2],
+        default=None,
     )
+    args = parser.parse_args()
+    if args.manifest is None and None in (
+        args.infile,
+        args.outfile,
+        args.version,
+        args.message,
+    ):
+        parser.error("--infile, --outfile, --version and --message are required")
+    if args.compress and args.base is not None:
+        parser.error("--compress cannot be combined with --base")
+    if args.manifest is not None:
+        protect_manifest(
+            args.manifest,
+            jobs=args.jobs,
+            cache_dir=None if args.no_cache else args.cache,
+        )
+    elif args.compress:
+        protect_compressed(
+            infile=args.infile,
+            outfile=args.outfile,
+            version=int(args.version),
+            message=args.message,
+            container=FORMATS[args.format],
+        )
+    elif args.base is None:
+        protect_firmware(
+            infile=args.infile,
+            outfile=args.outfile,
+            version=int(args.version),
+            message=args.message,
+            container=FORMATS[args.format],
+        )
+    else:
+        protect_delta(
+            infile=args.infile,
+            outfile=args.outfile,
+            version=int(args.version),
+            message=args.message,
+            base=args.base,
+            container=FORMATS[args.format],
+        )
 
 # sus impoter
 #                         ▁▃▄▅▆▆▇▇▇▇▆▅▄▃▁
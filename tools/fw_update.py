@@ -10,28 +10,89 @@ A frame consists of two sections:
 --------------------
 | Length | Data... |
 --------------------
+
+Windowed transfers (--window N, the default) prefix each frame with a
+sequence number so several frames can be in flight at once:
+
+[ 0x02 ]    [ 0x02 ]  [ variable ]
+--------------------------------
+| Sequence | Length | Data... |
+--------------------------------
+
+The bootloader answers every frame with ACK followed by the next sequence
+number it expects, so one ACK acknowledges every frame before it.
+
+Either way, the data of every frame is followed by the 32 byte link of the
+next frame in the hash chain from fw_protect.py, all zero after the last one.
+The head of the chain is sent with the signed headers, so the bootloader
+authenticates each frame as it arrives. The zero length frame has no link.
+
+Before the first frame the updater sends QUERY. The bootloader journals its
+progress in flash, so if an earlier attempt at the same bundle was cut off by
+a reset or a dropped link it replies OK and the number of bytes it already
+staged, and the transfer continues with the frame after them. Rerunning the
+updater is all it takes to resume.
+
+The image signature from fw_protect.py is sent right after the metadata has
+been echoed, for every kind of bundle.
+
+Delta bundles from fw_protect.py --base are announced with PATCH instead of
+META. The delta header and the hashes of the kept pages follow the metadata,
+and the changed pages are sent as ordinary frames.
+
+Compressed bundles from fw_protect.py --compress are announced with COMPRESSED.
+The compressed and uncompressed sizes follow the metadata, and the compressed
+image is sent as ordinary frames.
+
+v2 containers from fw_protect.py --format 2 are announced with CONTAINER. The
+36 byte container header takes the place of the metadata and is echoed the
+same way, its payload type says which of the above follows it.
+
+With --baud, the session starts by proposing a faster UART1 rate. The
+bootloader replies OK and the rate it grants (0 declines) at the old rate,
+then both sides switch and the updater sends SYNC at the new rate. If the
+bootloader's OK does not come back, the updater falls back to the default
+rate and waits until the bootloader has fallen back too.
+
+The update is driven by UpdateEngine, a state machine that only ever waits
+for the bootloader's replies. Each state has a deadline, and the states that
+can safely be repeated are retried when it passes.
+
+With --bench FILE the engine times every state and every frame's round trip
+and writes a JSON report when the update is done:
+
+states       seconds spent in each state and how often it was entered
+retries      requests resent in each state
+frames       count, bytes and send-to-ACK round trips (min, median, p95,
+             max and a histogram in milliseconds)
+throughput   firmware bytes per second over the frame transfer and over the
+             whole update
+split        host, transfer and device seconds. host is time spent outside
+             reads, transfer is the line time of every byte at the session
+             rate, device is the rest of the time spent waiting for replies.
+
+Against bl_emulate.py the UART sockets are not rate limited, so transfer is
+what real hardware would spend on the line rather than what was measured.
 """
 
 import argparse
+import collections
+import json
 import pathlib
+import socket
 import struct
 import time
-import socket
 
 from util import UART0_PATH, UART1_PATH, UART2_PATH, print_hex, DomainSocketSerial
 
 from Crypto.Hash import SHA256
-from Crypto.PublicKey import ECC
-from Crypto.Signature import DSS
-from pwn import *
+
+import signature
 
 
 # size of communication frame
 FRAME_SIZE = 256
 
-# size of header
-HEADER = 2
-
 # header types
 OK = b"O"
 ERROR = b"E"
@@ -40,6 +101,79 @@ BOOT = b"B"
 META = b"M"
 FIRM = b"C"
 DONE = b"D"
+WINDOW = b"W"
+ACK = b"A"
+PATCH = b"P"
+COMPRESSED = b"Z"
+RATE = b"R"
+SYNC = b"S"
+CONTAINER = b"V"
+QUERY = b"Q"
+
+# frames kept in flight during a windowed transfer, the bootloader may grant
+# fewer
+DEFAULT_WINDOW = 4
+
+# rate uart_init() sets up on the bootloader
+DEFAULT_BAUD = 115200
+
+# seconds the bootloader waits for SYNC after switching, and the quiet time
+# after which it drops a negotiated rate
+BAUD_CONFIRM_TIMEOUT = 1.0
+BAUD_IDLE_TIMEOUT = 5.0
+
+# seconds to wait for QEMU to open each UART socket
+CONNECT_TIMEOUT = 5.0
+
+# per-state deadline in seconds and the number of times the request may be
+# resent. Only UPDATE is resent: the bootloader ignores a stray 'U' once it is
+# waiting for metadata, but any other repeat would corrupt the stream.
+STATE_LIMITS = {
+    "BAUD": (1.0, 10),  # the device may still be starting up
+    "UPDATE": (1.0, 10),  # the device may still be starting up
+    "METADATA": (2.0, 0),
+    "FIRMWARE": (2.0, 0),
+    "FRAMES": (5.0, 0),  # per ACK, the device may be writing flash
+    "FINISH": (5.0, 0),
+    "INSTALL": (60.0, 0),  # signature check, decrypt and flash programming
+}
+
+# sizes within a protected firmware blob, the signature size depends on the
+# scheme bl_build selected
+METADATA_SIZE = 6
+
+# delta bundles, see fw_protect.py
+DELTA_MAGIC = b"ODLT"
+DELTA_BITMAP_SIZE = 12
+DELTA_HEADER_SIZE = 4 + DELTA_BITMAP_SIZE
+HASH_SIZE = 32
+
+# every frame is followed by the next link of the hash chain, see fw_protect.py
+CHAIN_LINK_SIZE = 32
+
+# compressed bundles, see fw_protect.py
+COMPRESSED_MAGIC = b"OLZC"
+COMPRESSION_HEADER_SIZE = 8
+
+# header sent instead of META for each kind of bundle
+BUNDLE_KINDS = {DELTA_MAGIC: PATCH, COMPRESSED_MAGIC: COMPRESSED}
+
+# v2 containers, see fw_protect.py. The header is not preceded by a magic of
+# its own, it starts with CONTAINER_MAGIC.
+CONTAINER_MAGIC = b"OBC2"
+CONTAINER_HEADER_FORMAT = "<4sHHHHII16s"
+CONTAINER_HEADER_SIZE = struct.calcsize(CONTAINER_HEADER_FORMAT)
+
+
+# upper bounds in milliseconds of the round trip histogram buckets, slower
+# round trips are counted under "more"
+RTT_BUCKETS_MS = [1, 2, 5, 10, 20, 50, 100, 200, 500, 1000]
+
+# bump when fields of the --bench report change meaning
+BENCH_REPORT_VERSION = 1
+
+# bits on the line per byte, 8N1
+UART_BITS_PER_BYTE = 10
 
 
 # crypto directory, where keys generated by bl_build are stored
@@ -48,192 +182,612 @@ CRYPTO_DIRECTORY = (
 )
 
 
-def send_metadata(ser, metadata, debug=False):
-    print("METADATA:")
-    # Parse version information
-    version, size = struct.unpack("<HH", metadata[64:68])
-    print(f"\tVersion: {version}\n\tSize: {size} bytes")
+class ProtocolError(RuntimeError):
+    pass
 
-    # Handshake with bootloader to send metadata
-    ser.write(META)
-    if debug:
-        print("\tMETA packet sent!")
-    while ser.read(HEADER) != OK:
-        time.sleep(0.2)
-    if debug:
-        print("\tPacket accepted by bootloader!")
 
-    # Send metadata
-    ser.write(metadata)
-    print("\tSending metadata!")
+class ProtocolTimeout(ProtocolError):
+    pass
 
-    time.sleep(0.2)
 
-    # Version
-    b_version = ser.read(2)
-    ## Version check
-    if b_version == ERROR:
-        raise RuntimeError("Invalid version request, aborting.")
-    # Version (cont.)
-    b_version = int(struct.unpack("<H", b_version)[0])
-    if debug:
-        print(f"\tVersion echoed by bootloader: {b_version}")
+class NullTelemetry:
+    # Stands in for BenchTelemetry when --bench is off
+    def state_started(self, state):
+        pass
 
-    time.sleep(0.2)
+    def state_finished(self, state):
+        pass
 
-    # Version size
-    b_size = bytes([])
-    while len(b_size) != 2:
-        b_size = ser.read(HEADER)
-    b_size = int(struct.unpack("<H", b_size)[0])
-    if debug:
-        print(f"\tVersion size echoed by bootloader: {b_size}")
+    def retried(self, state):
+        pass
 
-    time.sleep(0.2)
+    def frame_sent(self, index, size):
+        pass
 
-    # Message length
-    b_mlength = bytes([])
-    while len(b_mlength) != 2:
-        b_mlength = ser.read(HEADER)
-    b_mlength = int(struct.unpack("<H", b_mlength)[0])
-    if debug:
-        print(f"\tMessage length echoed by bootloader: {b_mlength}")
-
-    return True
-
-
-def send_firmware(ser, firmware, debug=False):
-    print("FIRMWARE:")
-
-    # Handshake with bootloader to send firmware
-    time.sleep(1)
-    ser.write(FIRM)
-
-    if debug:
-        print("\tFIRM packet sent!")
-    while ser.read(HEADER) != OK:
-        time.sleep(0.5)
-    if debug:
-        print("\tPacket accepted by bootloader!")
+    def frames_acked(self, count):
+        pass
 
-    print("\tSending firmware!")
 
-    # Send firmware in frames
-    for idx, frame_start in enumerate(range(0, len(firmware), FRAME_SIZE)):
-        data = firmware[frame_start : frame_start + FRAME_SIZE]
+class BenchTelemetry(NullTelemetry):
+    def __init__(self):
+        self.started = time.monotonic()
+        self.finished = None
+        self.state_seconds = {}
+        self.state_entries = {}
+        self.state_start = None
+        self.retries = {}
 
-        # Get length of data
-        length = len(data)
+        # Send times of the frames not acknowledged yet, by frame index
+        self.in_flight = {}
+        self.acked = 0
+        self.rtts = []
+        self.frame_bytes = 0
+        self.first_frame = None
+        self.last_ack = None
 
-        # Construct frame
-        frame = struct.pack(f"H{len(data)}s", length, data)
+        self.wait_seconds = 0.0
+        self.bytes_sent = 0
+        self.bytes_received = 0
 
-        time.sleep(0.5)
+    def state_started(self, state):
+        self.state_start = time.monotonic()
+        self.state_entries[state] = self.state_entries.get(state, 0) + 1
 
-        # Send frame
-        send_frame(ser, frame, debug=debug)
-
-        if debug:
-            print(f"Wrote frame {idx} ({len(frame)} bytes).")
-
-        time.sleep(0.2)
-
-    # Send a zero frame
-    ser.write(struct.pack(">H", 0x0000))
-
-    # Wait for an OK from the bootloader
-    resp = ser.read(1)
-    if resp != OK:
-        raise RuntimeError(
-            "ERROR: Bootloader responded to zero length frame with {}".format(
-                repr(resp)
-            )
+    def state_finished(self, state):
+        now = time.monotonic()
+        self.state_seconds[state] = (
+            self.state_seconds.get(state, 0.0) + now - self.state_start
+        )
+        self.finished = now
+
+    def retried(self, state):
+        self.retries[state] = self.retries.get(state, 0) + 1
+
+    def frame_sent(self, index, size):
+        now = time.monotonic()
+        if self.first_frame is None:
+            self.first_frame = now
+        self.in_flight[index] = now
+        self.frame_bytes += size
+
+    def frames_acked(self, count):
+        # An ACK covers every frame before count
+        now = time.monotonic()
+        for index in range(self.acked, count):
+            self.rtts.append(now - self.in_flight.pop(index))
+        self.acked = max(self.acked, count)
+        self.last_ack = now
+
+    def waited(self, seconds, received):
+        self.wait_seconds += seconds
+        self.bytes_received += received
+
+    def wrote(self, sent):
+        self.bytes_sent += sent
+
+    def report(self, firmware_size, kind, window, baud):
+        total = (self.finished or time.monotonic()) - self.started
+        transfer = (
+            (self.bytes_sent + self.bytes_received) * UART_BITS_PER_BYTE / baud
+        )
+        frame_seconds = (
+            self.last_ack - self.first_frame if self.first_frame is not None else 0.0
         )
 
-    return ser
-
-
-def send_frame(ser, frame, debug=False):
-    # Write the frame
-    ser.write(frame)
-    if debug:
-        print_hex(frame)
-
-    # Wait for an OK from the bootloader
-    time.sleep(0.4)
-
-    resp = ser.read(1)
-
-    time.sleep(0.2)
+        rtts_ms = sorted(rtt * 1000 for rtt in self.rtts)
+        histogram = {str(bound): 0 for bound in RTT_BUCKETS_MS}
+        histogram["more"] = 0
+        for rtt in rtts_ms:
+            bucket = next((b for b in RTT_BUCKETS_MS if rtt <= b), None)
+            histogram[str(bucket) if bucket is not None else "more"] += 1
+
+        def percentile(fraction):
+            if not rtts_ms:
+                return None
+            return rtts_ms[min(len(rtts_ms) - 1, int(fraction * len(rtts_ms)))]
+
+        return {
+            "version": BENCH_REPORT_VERSION,
+            "firmware_bytes": firmware_size,
+            "kind": kind.decode(),
+            "window": window,
+            "baud": baud,
+            "seconds": total,
+            "states": {
+                state: {"seconds": seconds, "entries": self.state_entries[state]}
+                for state, seconds in self.state_seconds.items()
+            },
+            "retries": self.retries,
+            "frames": {
+                "count": len(self.rtts),
+                "bytes": self.frame_bytes,
+                "rtt_ms": {
+                    "min": rtts_ms[0] if rtts_ms else None,
+                    "median": percentile(0.5),
+                    "p95": percentile(0.95),
+                    "max": rtts_ms[-1] if rtts_ms else None,
+                    "histogram": histogram,
+                },
+            },
+            "throughput": {
+                "frames_bytes_per_s": (
+                    self.frame_bytes / frame_seconds if frame_seconds else None
+                ),
+                "update_bytes_per_s": firmware_size / total if total else None,
+            },
+            "split": {
+                "host_s": total - self.wait_seconds,
+                "transfer_s": transfer,
+                "device_s": max(0.0, self.wait_seconds - transfer),
+                "bytes_sent": self.bytes_sent,
+                "bytes_received": self.bytes_received,
+            },
+        }
+
+
+class MeteredSerial:
+    # Passes everything through to ser, timing reads and counting bytes for
+    # a BenchTelemetry
+    def __init__(self, ser, telemetry):
+        self.ser = ser
+        self.telemetry = telemetry
+
+    def read(self, length):
+        start = time.monotonic()
+        try:
+            data = self.ser.read(length)
+        except socket.timeout:
+            self.telemetry.waited(time.monotonic() - start, 0)
+            raise
+        self.telemetry.waited(time.monotonic() - start, len(data))
+        return data
+
+    def write(self, data):
+        self.telemetry.wrote(len(data))
+        self.ser.write(data)
+
+    def __getattr__(self, name):
+        return getattr(self.ser, name)
+
+
+class UpdateEngine:
+    def __init__(
+        self,
+        ser,
+        signature,
+        metadata,
+        firmware,
+        window,
+        boot,
+        debug,
+        kind=META,
+        extension=b"",
+        baud=None,
+        telemetry=None,
+        log=print,
+    ):
+        self.ser = MeteredSerial(ser, telemetry) if telemetry else ser
+        self.telemetry = telemetry or NullTelemetry()
+        self.log = log
+        self.signature = signature
+        self.metadata = metadata
+        self.firmware = firmware
+        self.kind = kind
+        self.extension = extension
+        self.window = window
+        self.boot = boot
+        self.debug = debug
+        self.baud = baud
+
+        self.state = "BAUD" if baud else "UPDATE"
+        self.handlers = {
+            "BAUD": self.do_baud,
+            "UPDATE": self.do_update,
+            "METADATA": self.do_metadata,
+            "FIRMWARE": self.do_firmware,
+            "FRAMES": self.do_frames if window else self.do_frames_stop_and_wait,
+            "FINISH": self.do_finish,
+            "INSTALL": self.do_install,
+            "BOOT": self.do_boot,
+        }
+
+    def run(self):
+        while self.state != "DONE":
+            if self.debug:
+                self.log(f"[{self.state}]")
+            state = self.state
+            self.telemetry.state_started(state)
+            self.state = self.handlers[state]()
+            self.telemetry.state_finished(state)
+
+    # Read exactly length bytes, failing once the current state's deadline
+    # passes
+    def expect(self, length, timeout=None):
+        if timeout is None:
+            timeout = STATE_LIMITS[self.state][0]
+        deadline = time.monotonic() + timeout
+
+        data = b""
+        while len(data) < length:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise ProtocolTimeout(
+                    f"ERROR: Timed out in {self.state} after {timeout}s"
+                )
+            self.ser.set_timeout(remaining)
+            try:
+                chunk = self.ser.read(length - len(data))
+            except socket.timeout:
+                continue
+            if not chunk:
+                raise ProtocolError("ERROR: Connection to bootloader closed")
+            data += chunk
+        return data
+
+    # Expect a single reply byte, anything but the wanted one ends the update
+    def expect_reply(self, wanted):
+        resp = self.expect(1)
+        if resp == ERROR:
+            raise ProtocolError(f"ERROR: Bootloader rejected the update in {self.state}")
+        if resp != wanted:
+            raise ProtocolError(
+                "ERROR: Bootloader responded with {} in {}".format(
+                    repr(resp), self.state
+                )
+            )
 
-    if resp != OK:
-        raise RuntimeError("ERROR: Bootloader responded with {}".format(repr(resp)))
-    if debug:
-        print("Resp: {}".format(ord(resp)))
+    # Send a request and wait for OK, resending it as the state allows
+    def request(self, packet):
+        timeout, retries = STATE_LIMITS[self.state]
+        for attempt in range(retries + 1):
+            self.ser.write(packet)
+            try:
+                self.expect_reply(OK)
+                return
+            except ProtocolTimeout:
+                if attempt == retries:
+                    raise
+                self.telemetry.retried(self.state)
+                if self.debug:
+                    self.log(f"\tNo reply, resending {repr(packet)}")
+
+    def do_baud(self):
+        self.log(f"BAUD: Proposing {self.baud} baud.")
+        self.request(RATE + struct.pack("<I", self.baud))
+        try:
+            (granted,) = struct.unpack("<I", self.expect(4))
+        except ProtocolTimeout:
+            return self.baud_fallback()
+        if not granted:
+            self.log("\tRate declined, staying at the default rate.")
+            return "UPDATE"
+
+        # The bootloader has switched, confirm at the new rate
+        self.ser.set_baudrate(granted)
+        deadline = time.monotonic() + BAUD_CONFIRM_TIMEOUT
+        while time.monotonic() < deadline:
+            self.ser.write(SYNC)
+            try:
+                if self.expect(1, timeout=0.1) == OK:
+                    self.log(f"\tSwitched to {granted} baud.")
+                    return "UPDATE"
+            except ProtocolTimeout:
+                continue
+
+        return self.baud_fallback()
+
+    def baud_fallback(self):
+        # Anything sent before the bootloader falls back would arrive as noise
+        self.log("\tNo confirmation, falling back to the default rate.")
+        self.ser.set_baudrate(DEFAULT_BAUD)
+        time.sleep(BAUD_IDLE_TIMEOUT + BAUD_CONFIRM_TIMEOUT)
+        return "UPDATE"
+
+    def do_update(self):
+        self.log("UPDATE:")
+        self.request(UPDATE)
+        if self.debug:
+            self.log("\tPacket accepted by bootloader!")
+        return "METADATA"
+
+    def do_metadata(self):
+        self.log("METADATA:")
+        version, size, message_size = unpack_metadata(self.metadata)
+        self.log(f"\tVersion: {version}\n\tSize: {size} bytes")
+
+        # Handshake with bootloader to send metadata. A bootloader from before
+        # v2 containers ignores CONTAINER.
+        try:
+            self.request(self.kind)
+        except ProtocolTimeout:
+            if self.kind != CONTAINER:
+                raise
+            raise ProtocolError(
+                "ERROR: Bootloader does not support v2 containers, "
+                "protect with --format 1"
+            )
+        if self.debug:
+            self.log("\tPacket accepted by bootloader!")
+
+        self.ser.write(self.signature + self.metadata)
+        self.log("\tSending metadata!")
+
+        # The bootloader echoes the metadata or container header back
+        echo = self.expect(len(self.metadata))
+        if echo[:1] == ERROR:
+            raise ProtocolError("Invalid metadata, aborting.")
+        if echo != self.metadata:
+            raise ProtocolError(
+                "ERROR: Bootloader echoed metadata {}".format(echo.hex())
+            )
+        if self.debug:
+            self.log(f"\tMetadata echoed by bootloader: {version}, {size}, {message_size}")
+
+        # The image signature, any delta or compression header and the chain
+        # head follow the metadata
+        if self.extension:
+            self.ser.write(self.extension)
+        return "FIRMWARE"
+
+    def do_firmware(self):
+        self.log("FIRMWARE:")
+        self.frames = split_frames(self.firmware)
+        self.links = hash_chain(self.frames)
+
+        # Ask how much of this bundle an interrupted attempt already staged
+        self.request(QUERY)
+        (staged,) = struct.unpack("<I", self.expect(4))
+        if staged % FRAME_SIZE or staged > len(self.firmware):
+            raise ProtocolError(f"ERROR: Bootloader cannot resume from byte {staged}")
+        self.first_frame = staged // FRAME_SIZE
+        if staged:
+            self.log(
+                f"\tResuming at frame {self.first_frame} of {len(self.frames)}, "
+                f"{staged} bytes were already staged."
+            )
 
+        # Handshake with bootloader, asking for a window of frames if enabled
+        if self.window:
+            self.request(WINDOW + struct.pack("<B", self.window))
+            self.window = self.expect(1)[0]
+            if self.debug:
+                self.log(f"\tBootloader granted a window of {self.window} frames!")
+        else:
+            self.request(FIRM)
+            if self.debug:
+                self.log("\tPacket accepted by bootloader!")
+
+        self.log("\tSending firmware!")
+        return "FRAMES"
+
+    def do_frames(self):
+        # Keep up to window frames in flight, sliding forward on each ACK
+        sent = self.first_frame
+        acked = self.first_frame
+        while acked < len(self.frames):
+            while sent < len(self.frames) and sent - acked < self.window:
+                data = self.frames[sent]
+                self.telemetry.frame_sent(sent, len(data))
+                self.ser.write(
+                    struct.pack(f"<HH{len(data)}s", sent, len(data), data)
+                    + self.links[sent + 1]
+                )
+                if self.debug:
+                    self.log(f"Wrote frame {sent} ({len(data)} bytes).")
+                sent += 1
+
+            self.expect_reply(ACK)
+            acked = struct.unpack("<H", self.expect(2))[0]
+            self.telemetry.frames_acked(acked)
+            if self.debug:
+                self.log(f"Frames up to {acked} acknowledged.")
+
+        # Send a zero frame
+        self.ser.write(struct.pack("<HH", len(self.frames), 0x0000))
+        return "FINISH"
+
+    def do_frames_stop_and_wait(self):
+        for idx in range(self.first_frame, len(self.frames)):
+            data = self.frames[idx]
+            frame = struct.pack(f"<H{len(data)}s", len(data), data)
+            frame += self.links[idx + 1]
+            self.telemetry.frame_sent(idx, len(data))
+            self.ser.write(frame)
+            if self.debug:
+                print_hex(frame)
+
+            # Wait for an OK from the bootloader
+            self.expect_reply(OK)
+            self.telemetry.frames_acked(idx + 1)
+            if self.debug:
+                self.log(f"Wrote frame {idx} ({len(frame)} bytes).")
+
+        # Send a zero frame
+        self.ser.write(struct.pack("<H", 0x0000))
+        return "FINISH"
+
+    def do_finish(self):
+        # OK for the zero length frame, the bootloader then verifies and installs
+        self.expect_reply(OK)
+        return "INSTALL"
+
+    def do_install(self):
+        self.expect_reply(OK)
+        self.log("\tDone writing firmware.")
+        return "BOOT" if self.boot else "DONE"
+
+    def do_boot(self):
+        self.ser.write(BOOT)
+        self.log("BOOT: Boot request sent.")
+        return "DONE"
+
+
+def split_frames(data):
+    return [
+        data[start : start + FRAME_SIZE] for start in range(0, len(data), FRAME_SIZE)
+    ]
+
+
+# Links of the hash chain over the frames, the head first and the all zero
+# link after the last frame at the end
+def hash_chain(frames):
+    links = [bytes(CHAIN_LINK_SIZE)]
+    for data in reversed(frames):
+        links.append(SHA256.new(data + links[-1]).digest())
+    return links[::-1]
+
+
+# Version, size and message size from v1 metadata or a container header
+def unpack_metadata(metadata):
+    if len(metadata) == METADATA_SIZE:
+        return struct.unpack("<HHH", metadata)
+    header = struct.unpack(CONTAINER_HEADER_FORMAT, metadata)
+    return header[3], header[5], header[6]
+
+
+# A protected bundle split into what UpdateEngine sends
+Bundle = collections.namedtuple(
+    "Bundle", ["signature", "metadata", "firmware", "kind", "extension"]
+)
 
-def update(ser, infile, debug):
-    response = None
 
+# Read a bundle from fw_protect.py and check its signature
+def load_bundle(infile, debug=False):
     # Read firmware blob
     with open(infile, "rb") as fp:
         firmware_blob = fp.read()
 
-    print("Connected!")
-
-    time.sleep(3)
-
-    print("UPDATE:")
-    ser.write(UPDATE)
-    if debug:
-        print("\tPacket sent!")
-
-    # Wait for an OK from the bootloader
-    while response != OK:
-        response = ser.read(HEADER)
-    if debug:
-        print("\tPacket accepted by bootloader!")
-
-    # Parse firmware blob
-    signature = firmware_blob[0:64]
-    metadata = firmware_blob[64:70]
-    firmware = firmware_blob[70:]
+    scheme = signature.read_scheme(CRYPTO_DIRECTORY)
+    signature_size = signature.SCHEMES[scheme]
+
+    if firmware_blob.startswith(CONTAINER_MAGIC):
+        # The container header comes before the signature, and its payload
+        # type takes the place of the marker
+        kind = CONTAINER
+        metadata = firmware_blob[:CONTAINER_HEADER_SIZE]
+        payload = bytes([metadata[6]])
+        sig = firmware_blob[CONTAINER_HEADER_SIZE : CONTAINER_HEADER_SIZE + signature_size]
+        firmware = firmware_blob[CONTAINER_HEADER_SIZE + signature_size :]
+        signed_prefix = CONTAINER
+    else:
+        # Delta and compressed bundles are marked, the marker is not sent
+        kind = BUNDLE_KINDS.get(firmware_blob[:4], META)
+        if kind != META:
+            firmware_blob = firmware_blob[4:]
+        payload = kind
+
+        # Parse firmware blob
+        sig = firmware_blob[0:signature_size]
+        metadata = firmware_blob[signature_size : signature_size + METADATA_SIZE]
+        firmware = firmware_blob[signature_size + METADATA_SIZE :]
+        signed_prefix = b"" if kind == META else kind
+
+    # Every bundle carries a signature over the plain image right after the
+    # metadata, the bootloader keeps it for checking the image at boot
+    image_sig = firmware[:signature_size]
+    firmware = firmware[signature_size:]
+
+    extension = b""
+    if payload == PATCH:
+        page_count, changed_count = struct.unpack("<HH", firmware[:4])
+        extension_size = DELTA_HEADER_SIZE + (page_count - changed_count) * HASH_SIZE
+        extension = firmware[:extension_size]
+        firmware = firmware[extension_size:]
+        print(f"\tDelta: {changed_count} of {page_count} pages changed.")
+    elif payload == COMPRESSED:
+        extension = firmware[:COMPRESSION_HEADER_SIZE]
+        firmware = firmware[COMPRESSION_HEADER_SIZE:]
+        compressed_size, image_size = struct.unpack("<II", extension)
+        print(f"\tCompressed: {image_size} bytes sent as {compressed_size}.")
+
+    # The chain head is signed, the frames it authenticates are not
+    head = firmware[:CHAIN_LINK_SIZE]
+    firmware = firmware[CHAIN_LINK_SIZE:]
+    if hash_chain(split_frames(firmware))[0] != head:
+        raise RuntimeError("Frame chain does not match the firmware, aborting.")
+    extension = image_sig + extension + head
 
     # Check for integrity compromise using SHA hash
     if debug:
         print("\tVerifying firmware data!")
-    hasher = SHA256.new(metadata + firmware)
+    hasher = SHA256.new(signed_prefix + metadata + extension)
     hasherd = SHA256.new(metadata)
     if debug:
         print("Metadata-only SHA256 hash: ", hasherd.hexdigest())
         print("Complete SHA256 hash: ", hasher.hexdigest())
 
-    # Check for integrity compromise using ECC public key signature
-    key = None
-    with open(CRYPTO_DIRECTORY / "ecc_public.raw", "rb") as fp:
-        key = ECC.import_key(fp.read(), curve_name="secp256r1")
-    verifier = DSS.new(key, "fips-186-3")
+    # Check for integrity compromise using the public key of the selected
+    # scheme
+    key = signature.load_public_key(CRYPTO_DIRECTORY, scheme)
     try:
-        verifier.verify(hasher, signature)
-        print("\tSignature verified on the client.")
+        signature.verify(key, scheme, hasher, sig)
+        print(f"\tSignature verified on the client ({scheme}).")
     except ValueError:
         raise RuntimeError("Invalid signature, aborting.")
 
+    return Bundle(sig, metadata, firmware, kind, extension)
+
+
+def update(
+    ser, infile, debug, window=DEFAULT_WINDOW, boot=False, baud=None, bench=None
+):
+    print("Connected!")
+    bundle = load_bundle(infile, debug)
+
     # Proceed to sending data.
+    telemetry = BenchTelemetry() if bench else None
+    engine = UpdateEngine(
+        ser,
+        bundle.signature,
+        bundle.metadata,
+        bundle.firmware,
+        window,
+        boot,
+        debug,
+        kind=bundle.kind,
+        extension=bundle.extension,
+        baud=baud,
+        telemetry=telemetry,
+    )
+    engine.run()
+
+    if telemetry:
+        write_bench_report(
+            bench,
+            telemetry.report(
+                len(bundle.firmware), bundle.kind, engine.window, ser.baudrate
+            ),
+        )
 
-    # Send metadata
-    send_metadata(ser, signature + metadata, debug=debug)
+    if not boot:
+        print("Send B on UART1 (or rerun with --boot) to boot the new firmware.")
 
-    # Send firmware
-    send_firmware(ser, firmware, debug=debug)
-    print("\tDone writing firmware.")
 
-    # Want to boot?
-    while 1:
-        boot_q = str(input("Enter B to boot. ")).strip()
-        if boot_q == "B":
-            break
-    ser.write(BOOT)
+def write_bench_report(path, report):
+    text = json.dumps(report, indent=2)
+    if path == "-":
+        print(text)
+    else:
+        with open(path, "w") as fp:
+            fp.write(text + "\n")
+
+    throughput = report["throughput"]["update_bytes_per_s"]
+    print(f"BENCH: {report['seconds']:.3f}s, {throughput:.0f} bytes/s.")
+
+
+# QEMU opens the UART sockets one after another, so retry until it is there
+def connect_uart(path, timeout=CONNECT_TIMEOUT):
+    deadline = time.monotonic() + timeout
+    while True:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(path)
+            return sock
+        except (FileNotFoundError, ConnectionRefusedError):
+            sock.close()
+            if time.monotonic() >= deadline:
+                raise
+            time.sleep(0.01)
 
 
 if __name__ == "__main__":
@@ -248,27 +802,51 @@ if __name__ == "__main__":
     parser.add_argument(
         "--debug", help="Enable debugging messages.", action="store_true", default=False
     )
+    parser.add_argument(
+        "--window",
+        help="Frames to keep in flight, 0 for stop-and-wait.",
+        type=int,
+        default=DEFAULT_WINDOW,
+    )
+    parser.add_argument(
+        "--boot",
+        help="Boot the new firmware once it is installed.",
+        action="store_true",
+        default=False,
+    )
 
-    args = parser.parse_args()
+    parser.add_argument(
+        "--baud",
+        help="Propose a faster UART1 rate for the update.",
+        type=int,
+        default=None,
+    )
 
-    uart0_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart0_sock.connect(UART0_PATH)
+    parser.add_argument(
+        "--bench",
+        help="Write a JSON timing report of the update to this file (- for stdout).",
+        default=None,
+    )
 
-    time.sleep(0.2)  # QEMU takes a moment to open the next socket
+    args = parser.parse_args()
 
-    uart1_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart1_sock.connect(UART1_PATH)
+    uart0_sock = connect_uart(UART0_PATH)
+    uart1_sock = connect_uart(UART1_PATH)
     uart1 = DomainSocketSerial(uart1_sock)
-
-    time.sleep(0.2)
-
-    uart2_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
-    uart2_sock.connect(UART2_PATH)
+    uart2_sock = connect_uart(UART2_PATH)
 
     # Close unused UARTs (if we leave these open it will hang)
     uart2_sock.close()
     uart0_sock.close()
 
-    update(ser=uart1, infile=args.firmware, debug=args.debug)
+    update(
+        ser=uart1,
+        infile=args.firmware,
+        debug=args.debug,
+        window=args.window,
+        boot=args.boot,
+        baud=args.baud,
+        bench=args.bench,
+    )
 
     uart1_sock.close()
@@ -0,0 +1,111 @@
+#!/usr/bin/env python
+"""
+Profile Report Reader
+
+A bootloader built with bl_build.py --profile sends a binary report on UART2
+after every update, right after "Ready to boot!":
+
+[ 0x04 ]  [ 0x01 ]  [ 0x01 ]  [ 24 bytes per phase ]
+----------------------------------------------------
+| PROF | Version | Phases | Phase statistics... |
+----------------------------------------------------
+
+Phase statistics are little endian count (u32), min (u32), max (u32) and
+total (u64) cycles, in the order of PHASES. Both lists follow profile_phase
+in bootloader/src/profile.h.
+"""
+
+import argparse
+import socket
+import struct
+
+from util import UART2_PATH
+
+MAGIC = b"PROF"
+# The report follows this line, which keeps stray "PROF" bytes in earlier
+# reports from being taken for the start of the last one
+READY_LINE = b"Ready to boot!\n"
+VERSION = 1
+PHASES = [
+    "update",
+    "metadata",
+    "frame",
+    "sha256",
+    "verify",
+    "aes",
+    "decompress",
+    "flash",
+]
+PHASE_FORMAT = "<IIIQ"
+PHASE_SIZE = struct.calcsize(PHASE_FORMAT)
+
+
+def decode_report(data):
+    # Returns {phase: (count, min, max, total)}, or None without a report
+    start = data.rfind(READY_LINE + MAGIC)
+    if start < 0:
+        return None
+    start += len(READY_LINE)
+    if len(data) < start + len(MAGIC) + 2:
+        return None
+
+    version, phase_count = data[start + len(MAGIC) : start + len(MAGIC) + 2]
+    if version != VERSION or phase_count != len(PHASES):
+        raise ValueError(
+            f"Unsupported report version {version} with {phase_count} phases"
+        )
+
+    body = data[start + len(MAGIC) + 2 :]
+    if len(body) < phase_count * PHASE_SIZE:
+        return None
+
+    return {
+        name: struct.unpack_from(PHASE_FORMAT, body, i * PHASE_SIZE)
+        for i, name in enumerate(PHASES)
+    }
+
+
+def print_report(report):
+    print(f"{'phase':<12}{'count':>8}{'min':>12}{'max':>12}{'mean':>12}{'total':>14}")
+    for name, (count, low, high, total) in report.items():
+        if not count:
+            print(f"{name:<12}{0:>8}{'-':>12}{'-':>12}{'-':>12}{0:>14}")
+            continue
+        print(
+            f"{name:<12}{count:>8}{low:>12}{high:>12}{total // count:>12}{total:>14}"
+        )
+
+
+def read_uart(path):
+    uart = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    uart.connect(path)
+
+    data = b""
+    while True:
+        chunk = uart.recv(4096)
+        if not chunk:
+            raise ConnectionError("UART2 closed before a report arrived")
+        data += chunk
+
+        report = decode_report(data)
+        if report is not None:
+            return report
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Profile Report Reader")
+    parser.add_argument(
+        "--file", help="Read a saved capture of UART2 instead of the emulator."
+    )
+    parser.add_argument("--uart", help="UART2 socket to read.", default=UART2_PATH)
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, "rb") as fp:
+            report = decode_report(fp.read())
+        if report is None:
+            raise SystemExit("No complete profile report in the capture")
+    else:
+        report = read_uart(args.uart)
+
+    print_report(report)
@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+"""
+Signature Schemes
+
+bl_build.py picks the scheme the bootloader verifies with (--signature) and
+records it in the crypto directory. fw_protect.py signs and fw_update.py
+checks signatures with whichever scheme was recorded.
+
+ecdsa      ECDSA P-256, 64-byte raw (r || s) signatures
+rsa-pkcs1  RSA-2048 PKCS#1 v1.5, e = 65537, 256-byte signatures
+rsa-pss    RSA-2048 PSS with SHA-256 and a 32-byte salt, e = 65537
+
+Every scheme signs a SHA-256 digest. RSA signatures are four times larger,
+but with e = 65537 they verify much faster on the Cortex-M3.
+"""
+
+from Crypto.PublicKey import ECC, RSA
+from Crypto.Signature import DSS, pkcs1_15, pss
+
+# signature size in bytes for each scheme
+SCHEMES = {"ecdsa": 64, "rsa-pkcs1": 256, "rsa-pss": 256}
+DEFAULT_SCHEME = "ecdsa"
+
+# names of the scheme in the generated signature.h
+C_SCHEMES = {
+    "ecdsa": "SIGNATURE_ECDSA_P256",
+    "rsa-pkcs1": "SIGNATURE_RSA_PKCS1",
+    "rsa-pss": "SIGNATURE_RSA_PSS",
+}
+
+RSA_BITS = 2048
+RSA_EXPONENT = 65537
+PSS_SALT_SIZE = 32
+
+# files in the crypto directory
+SCHEME_FILE = "scheme.txt"
+PUBLIC_KEY_FILES = {
+    "ecdsa": "ecc_public.raw",
+    "rsa-pkcs1": "rsa_public.der",
+    "rsa-pss": "rsa_public.der",
+}
+
+
+def read_scheme(crypto_dir):
+    # Builds from before the scheme was selectable used ECDSA
+    try:
+        with open(crypto_dir / SCHEME_FILE) as fp:
+            scheme = fp.read().strip()
+    except FileNotFoundError:
+        return DEFAULT_SCHEME
+
+    if scheme not in SCHEMES:
+        raise ValueError(f"Unknown signature scheme {scheme!r}")
+    return scheme
+
+
+def generate_key(scheme):
+    if scheme == "ecdsa":
+        return ECC.generate(curve="secp256r1")
+    return RSA.generate(RSA_BITS, e=RSA_EXPONENT)
+
+
+def export_private_key(key):
+    # ECC keys export as str, RSA keys as bytes
+    pem = key.export_key(format="PEM")
+    return pem.encode() if isinstance(pem, str) else pem
+
+
+def import_private_key(data, scheme):
+    if scheme == "ecdsa":
+        return ECC.import_key(data)
+    return RSA.import_key(data)
+
+
+def export_public_key(key, scheme):
+    if scheme == "ecdsa":
+        return key.public_key().export_key(format="raw")
+    return key.public_key().export_key(format="DER")
+
+
+def load_public_key(crypto_dir, scheme):
+    with open(crypto_dir / PUBLIC_KEY_FILES[scheme], "rb") as fp:
+        data = fp.read()
+    if scheme == "ecdsa":
+        return ECC.import_key(data, curve_name="secp256r1")
+    return RSA.import_key(data)
+
+
+def _scheme_object(key, scheme):
+    if scheme == "ecdsa":
+        return DSS.new(key, "fips-186-3")
+    if scheme == "rsa-pkcs1":
+        return pkcs1_15.new(key)
+    return pss.new(key, salt_bytes=PSS_SALT_SIZE)
+
+
+def sign(key, scheme, digest):
+    # digest is a Crypto.Hash.SHA256 object
+    return _scheme_object(key, scheme).sign(digest)
+
+
+def verify(key, scheme, digest, signature):
+    # Raises ValueError if the signature does not match
+    _scheme_object(key, scheme).verify(digest, signature)
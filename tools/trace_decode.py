@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+"""
+Trace Decoder
+
+A bootloader built with bl_build.py --trace sends binary trace records on
+UART2, between its lines of text:
+
+[ 0x01 ]  [ 0x01 ]  [ 0x02 ]     [ 4 bytes per argument ]
+---------------------------------------------------------
+| Sync  | Event  | Time (ms) | Arguments...           |
+---------------------------------------------------------
+
+Sync is 0xA5, which never appears in the text. The time is the low 16 bits
+of the bootloader's millisecond tick, and the events, their argument counts
+and formats are read from TRACE_EVENTS in bootloader/src/trace.h. Text is
+passed through and every record becomes a line of its own.
+"""
+
+import argparse
+import pathlib
+import re
+import socket
+import struct
+import sys
+
+from util import UART2_PATH
+
+TRACE_HEADER = (
+    pathlib.Path(__file__).parent / ".." / "bootloader" / "src" / "trace.h"
+)
+
+SYNC = 0xA5
+HEADER_FORMAT = "<BBH"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+EVENT_PATTERN = re.compile(
+    r'X\((\w+),\s*(\w+),\s*(\d+),\s*"((?:[^"\\]|\\.)*)"\)'
+)
+
+
+def read_events(path=TRACE_HEADER):
+    # [(name, level, argument count, format)] in event number order
+    source = pathlib.Path(path).read_text().replace("\\\n", " ")
+    body = source[source.index("#define TRACE_EVENTS(X)") :]
+    body = body[: body.index("\n")]
+    return [
+        (name, level, int(argc), fmt)
+        for name, level, argc, fmt in EVENT_PATTERN.findall(body)
+    ]
+
+
+class Decoder:
+    def __init__(self, events, out=sys.stdout):
+        self.events = events
+        self.out = out
+        self.buffer = b""
+        self.text = b""
+        self.last_time = None
+        self.wraps = 0
+
+    def feed(self, data):
+        self.buffer += data
+        while self.buffer:
+            # Text up to the next record
+            sync = self.buffer.find(bytes([SYNC]))
+            if sync < 0:
+                self.write_text(self.buffer)
+                self.buffer = b""
+                return
+            if sync > 0:
+                self.write_text(self.buffer[:sync])
+                self.buffer = self.buffer[sync:]
+
+            if len(self.buffer) < HEADER_SIZE:
+                return
+            _, event, time = struct.unpack_from(HEADER_FORMAT, self.buffer)
+            if event >= len(self.events):
+                self.out.write(f"<unknown trace event {event}>\n")
+                self.buffer = self.buffer[1:]
+                continue
+
+            name, _, argc, fmt = self.events[event]
+            size = HEADER_SIZE + 4 * argc
+            if len(self.buffer) < size:
+                return
+            args = struct.unpack_from(f"<{argc}I", self.buffer, HEADER_SIZE)
+            self.buffer = self.buffer[size:]
+            self.write_record(time, fmt, args)
+
+    def write_text(self, data):
+        self.text += data
+        *lines, self.text = self.text.split(b"\n")
+        for line in lines:
+            self.out.write(line.decode(errors="replace") + "\n")
+
+    def write_record(self, time, fmt, args):
+        # The tick wraps every 65.536s, records are assumed to come more
+        # often than that
+        if self.last_time is not None and time < self.last_time:
+            self.wraps += 1
+        self.last_time = time
+        ms = self.wraps * 0x10000 + time
+        self.out.write(f"{ms:>9} ms  {fmt.format(*args)}\n")
+
+
+def read_uart(path, decoder):
+    uart = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    uart.connect(path)
+    while True:
+        chunk = uart.recv(4096)
+        if not chunk:
+            break
+        decoder.feed(chunk)
+        decoder.out.flush()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Trace Decoder")
+    parser.add_argument(
+        "--file", help="Decode a saved capture of UART2 instead of the emulator."
+    )
+    parser.add_argument("--uart", help="UART2 socket to read.", default=UART2_PATH)
+    parser.add_argument(
+        "--header", help="trace.h the bootloader was built with.", default=TRACE_HEADER
+    )
+    args = parser.parse_args()
+
+    decoder = Decoder(read_events(args.header))
+    if args.file:
+        with open(args.file, "rb") as fp:
+            decoder.feed(fp.read())
+    else:
+        read_uart(args.uart, decoder)
+    decoder.write_text(b"\n" if decoder.text else b"")
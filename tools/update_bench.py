@@ -0,0 +1,325 @@
+#!/usr/bin/env python
+"""
+Update Benchmark
+
+Builds the bootloader with a SysTick profile clock (bl_build.py --profile
+systick), then updates it in QEMU with images of several sizes and checks the
+results against a baseline. QEMU runs with -icount, so the cycles the
+bootloader reports for each phase depend only on the instructions it runs,
+not on the host.
+
+Every case starts a fresh QEMU, so each update begins from the initial
+firmware. Each case runs --runs times: the throughput kept is the median, and
+the cycle counts should come out the same every run.
+
+The results are written as JSON. A phase regresses if its total cycles grow
+by more than --max-cycle-increase, a case if its throughput falls by more
+than --max-throughput-drop. Only the phases that do not wait on the host are
+compared, the others are recorded. --save-baseline records the results as
+the new baseline instead of comparing.
+"""
+
+import argparse
+import json
+import pathlib
+import random
+import statistics
+import string
+import subprocess
+import sys
+import tempfile
+import threading
+
+from util import DomainSocketSerial, uart_paths
+
+import bl_build
+import bl_emulate
+import fw_protect
+import fw_update
+import profile_report
+import signature
+
+TOOL_DIR = pathlib.Path(__file__).parent.resolve()
+BOOT_PATH = TOOL_DIR / ".." / "bootloader" / "gcc" / "main.axf"
+DEFAULT_BASELINE = TOOL_DIR / "update_bench_baseline.json"
+
+RESULTS_VERSION = 1
+
+# Each instruction takes 2^ICOUNT_SHIFT ns of guest time
+ICOUNT_SHIFT = 0
+
+# firmware bytes, message bytes
+CASES = {
+    "1k": (1024, 16),
+    "8k": (8192, 16),
+    "30k": (30720, 16),
+    "max_message": (8192, fw_protect.MAX_MESSAGE_SIZE),
+}
+
+# Phases that only do work on the device. The rest include the time spent
+# waiting for the host, which -icount does not make repeatable.
+GATED_PHASES = ["sha256", "verify", "aes", "decompress", "flash"]
+
+# seconds to wait for the profile report once the update is done
+REPORT_TIMEOUT = 10.0
+
+
+def make_image(directory, name, size, message_size):
+    # Seeded by the case name, so every run sends the same bytes
+    rng = random.Random(name)
+    firmware = directory / f"{name}.bin"
+    firmware.write_bytes(rng.randbytes(size))
+
+    message = "".join(rng.choice(string.ascii_lowercase) for _ in range(message_size))
+    protected = directory / f"{name}.protected"
+    # Version 0 is a debug image, which any installed version accepts
+    fw_protect.protect_firmware(firmware, protected, 0, message)
+    return protected
+
+
+class Capture(threading.Thread):
+    # Keeps everything UART2 sends until it is closed
+    def __init__(self, sock):
+        super().__init__(daemon=True)
+        self.sock = sock
+        self.data = b""
+        self.report = None
+        self.arrived = threading.Event()
+
+    def run(self):
+        while True:
+            try:
+                chunk = self.sock.recv(4096)
+            except OSError:
+                break
+            if not chunk:
+                break
+            self.data += chunk
+            if self.report is None:
+                self.report = profile_report.decode_report(self.data)
+                if self.report is not None:
+                    self.arrived.set()
+
+
+def run_case(boot_path, bundle, window):
+    with tempfile.TemporaryDirectory() as directory:
+        cmd = bl_emulate.qemu_command(
+            str(boot_path), uart_paths(directory), headless=True, icount=ICOUNT_SHIFT
+        )
+        qemu = subprocess.Popen(cmd, cwd=directory, stdin=subprocess.DEVNULL)
+        sockets = []
+        try:
+            for path in uart_paths(directory):
+                sockets.append(fw_update.connect_uart(path))
+            sockets[0].close()
+            capture = Capture(sockets[2])
+            capture.start()
+
+            telemetry = fw_update.BenchTelemetry()
+            engine = fw_update.UpdateEngine(
+                DomainSocketSerial(sockets[1]),
+                bundle.signature,
+                bundle.metadata,
+                bundle.firmware,
+                window,
+                False,
+                False,
+                kind=bundle.kind,
+                extension=bundle.extension,
+                telemetry=telemetry,
+                log=lambda message: None,
+            )
+            engine.run()
+
+            if not capture.arrived.wait(REPORT_TIMEOUT):
+                raise RuntimeError("No profile report on UART2, was --profile systick built?")
+            report = telemetry.report(
+                len(bundle.firmware), bundle.kind, engine.window, fw_update.DEFAULT_BAUD
+            )
+            return report, capture.report
+        finally:
+            for sock in sockets:
+                sock.close()
+            qemu.terminate()
+            qemu.wait()
+
+
+def summarize(name, firmware_size, message_size, runs):
+    reports = [report for report, _ in runs]
+    cycles = [profile for _, profile in runs]
+
+    # -icount makes the device deterministic, any difference is a bug in the
+    # setup rather than noise
+    for phase in GATED_PHASES:
+        totals = {profile[phase][3] for profile in cycles}
+        if len(totals) > 1:
+            print(f"WARNING: {name} {phase} cycles differ between runs: {sorted(totals)}")
+
+    return {
+        "firmware_bytes": firmware_size,
+        "message_bytes": message_size,
+        "sent_bytes": reports[0]["firmware_bytes"],
+        "seconds": statistics.median(report["seconds"] for report in reports),
+        "bytes_per_s": statistics.median(
+            report["throughput"]["update_bytes_per_s"] for report in reports
+        ),
+        "states": {
+            state: statistics.median(
+                report["states"][state]["seconds"] for report in reports
+            )
+            for state in reports[0]["states"]
+        },
+        "cycles": {
+            phase: dict(zip(("count", "min", "max", "total"), stats))
+            for phase, stats in cycles[0].items()
+        },
+    }
+
+
+def compare(results, baseline, max_throughput_drop, max_cycle_increase):
+    # Returns the regressions found, as lines to print
+    failures = []
+    if baseline.get("icount_shift") != results["icount_shift"]:
+        failures.append(
+            f"baseline was recorded with -icount shift={baseline.get('icount_shift')}"
+        )
+        return failures
+
+    for name, case in results["cases"].items():
+        base = baseline["cases"].get(name)
+        if base is None:
+            print(f"{name}: not in the baseline, skipped")
+            continue
+
+        floor = base["bytes_per_s"] * (1 - max_throughput_drop)
+        if case["bytes_per_s"] < floor:
+            failures.append(
+                f"{name}: {case['bytes_per_s']:.0f} bytes/s, "
+                f"baseline {base['bytes_per_s']:.0f} bytes/s"
+            )
+
+        for phase in GATED_PHASES:
+            total = case["cycles"][phase]["total"]
+            base_total = base["cycles"][phase]["total"]
+            if total > base_total * (1 + max_cycle_increase):
+                failures.append(
+                    f"{name}: {phase} took {total} cycles, baseline {base_total}"
+                )
+    return failures
+
+
+def print_results(results):
+    header = "".join(f"{phase:>12}" for phase in GATED_PHASES)
+    print(f"{'case':<12}{'bytes/s':>10}{header}")
+    for name, case in results["cases"].items():
+        cycles = "".join(
+            f"{case['cycles'][phase]['total']:>12}" for phase in GATED_PHASES
+        )
+        print(f"{name:<12}{case['bytes_per_s']:>10.0f}{cycles}")
+
+
+def main(args):
+    # bl_build changes directory
+    output = pathlib.Path(args.output).resolve()
+    baseline_path = pathlib.Path(args.baseline).resolve()
+    boot_path = pathlib.Path(args.boot_path).resolve()
+
+    if not args.no_build:
+        bl_build.main(
+            argparse.Namespace(
+                initial_firmware=args.initial_firmware,
+                signature=args.signature,
+                profile="systick",
+                trace=None,
+            )
+        )
+
+    results = {"version": RESULTS_VERSION, "icount_shift": ICOUNT_SHIFT, "cases": {}}
+    with tempfile.TemporaryDirectory() as directory:
+        directory = pathlib.Path(directory)
+        for name, (size, message_size) in CASES.items():
+            bundle = fw_update.load_bundle(make_image(directory, name, size, message_size))
+            runs = [run_case(boot_path, bundle, args.window) for _ in range(args.runs)]
+            results["cases"][name] = summarize(name, size, message_size, runs)
+
+    print_results(results)
+    with open(output, "w") as fp:
+        json.dump(results, fp, indent=2)
+        fp.write("\n")
+
+    if args.save_baseline:
+        with open(baseline_path, "w") as fp:
+            json.dump(results, fp, indent=2)
+            fp.write("\n")
+        print(f"Baseline saved to {baseline_path}")
+        return 0
+
+    try:
+        with open(baseline_path) as fp:
+            baseline = json.load(fp)
+    except FileNotFoundError:
+        print(f"No baseline at {baseline_path}, record one with --save-baseline")
+        return 1
+    if baseline.get("version") != RESULTS_VERSION:
+        print(f"Baseline {baseline_path} has an unsupported version")
+        return 1
+
+    failures = compare(
+        results, baseline, args.max_throughput_drop, args.max_cycle_increase
+    )
+    for failure in failures:
+        print(f"REGRESSION: {failure}")
+    if not failures:
+        print("No regressions against the baseline.")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Update Benchmark")
+    parser.add_argument("--initial-firmware", help="Path to the the firmware binary.")
+    parser.add_argument(
+        "--signature",
+        help="Signature scheme the bootloader verifies updates with.",
+        choices=sorted(signature.SCHEMES),
+        default=signature.DEFAULT_SCHEME,
+    )
+    parser.add_argument(
+        "--no-build",
+        help="Use the bootloader already built with --profile systick.",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--boot-path", help="Path to the the bootloader binary.", default=BOOT_PATH
+    )
+    parser.add_argument("--runs", help="Updates per case.", type=int, default=3)
+    parser.add_argument(
+        "--window",
+        help="Frames to keep in flight, 0 for stop-and-wait.",
+        type=int,
+        default=fw_update.DEFAULT_WINDOW,
+    )
+    parser.add_argument(
+        "--output", help="Write the results to this file.", default="update_bench.json"
+    )
+    parser.add_argument(
+        "--baseline", help="Results to compare against.", default=DEFAULT_BASELINE
+    )
+    parser.add_argument(
+        "--save-baseline",
+        help="Record the results as the baseline instead of comparing.",
+        action="store_true",
+    )
+    parser.add_argument(
+        "--max-throughput-drop",
+        help="Fraction the throughput of a case may fall by.",
+        type=float,
+        default=0.15,
+    )
+    parser.add_argument(
+        "--max-cycle-increase",
+        help="Fraction the cycles of a phase may grow by.",
+        type=float,
+        default=0.01,
+    )
+    args = parser.parse_args()
+    sys.exit(main(args))
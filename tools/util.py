@@ -3,15 +3,28 @@
 # Copyright 2023 The MITRE Corporation. ALL RIGHTS RESERVED
 # Approved for public release. Distribution unlimited 23-02181-13.
 
+import pathlib
 import socket
 
 UART0_PATH = "/embsec/UART0"
 UART1_PATH = "/embsec/UART1"
 UART2_PATH = "/embsec/UART2"
 
+
+# directory of one instance started by bl_emulate.py --instances
+def instance_dir(fleet_dir, index):
+    return pathlib.Path(fleet_dir) / f"device{index}"
+
+
+# UART0, UART1 and UART2 sockets of an instance directory
+def uart_paths(directory):
+    return [str(pathlib.Path(directory) / f"UART{n}") for n in range(3)]
+
+
 class DomainSocketSerial:
     def __init__(self, ser_socket: socket.socket):
         self.ser_socket = ser_socket
+        self.baudrate = 115200
     
     def read(self, length: int) -> bytes:
         if length < 1:
@@ -19,6 +32,14 @@ class DomainSocketSerial:
         
         return self.ser_socket.recv(length)
     
+    def set_timeout(self, timeout):
+        # None blocks forever, otherwise reads raise socket.timeout
+        self.ser_socket.settimeout(timeout)
+
+    def set_baudrate(self, baudrate):
+        # A socket has no line rate, the rate is only recorded
+        self.baudrate = baudrate
+
     def readline(self) -> bytes:
         line = b""
 
@@ -31,7 +52,7 @@ class DomainSocketSerial:
         return line
 
     def write(self, data: bytes):
-        self.ser_socket.send(data)
+        self.ser_socket.sendall(data)
 
     def close(self):
         self.ser_socket.close()